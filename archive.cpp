@@ -0,0 +1,131 @@
+/*-
+ * Copyright (c) 2023 Chris Spiegel
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string_view>
+
+#include <archive.h>
+#include <archive_entry.h>
+
+#include "archive.hpp"
+
+bool looks_like_archive(const void *data, std::size_t size)
+{
+    std::string_view header(static_cast<const char *>(data), std::min<std::size_t>(size, 8));
+
+    // LHA has no magic as such, just the compression method at offset 2:
+    // "-lh0-" through "-lh7-", "-lhd-", and the older "-lz?-" methods.
+    auto lha = [&header] {
+        return header.size() >= 7 && header[2] == '-' && header[3] == 'l' && (header[4] == 'h' || header[4] == 'z') && header[6] == '-';
+    };
+
+    return header.starts_with("PK\x03\x04") || header.starts_with("PK\x05\x06") || header.starts_with("7z\xbc\xaf\x27\x1c") ||
+           header.starts_with("Rar!\x1a\x07") || lha();
+}
+
+archive_reader::archive_reader(const void *data, std::size_t size) : a(archive_read_new())
+{
+    if (a == nullptr) {
+        throw std::runtime_error("can't create archive reader");
+    }
+
+    archive_read_support_format_zip(a);
+    archive_read_support_format_7zip(a);
+    archive_read_support_format_lha(a);
+    archive_read_support_format_rar(a);
+    archive_read_support_format_rar5(a);
+
+    if (archive_read_open_memory(a, data, size) != ARCHIVE_OK) {
+        fail();
+    }
+}
+
+archive_reader::~archive_reader()
+{
+    archive_read_free(a);
+}
+
+void archive_reader::fail()
+{
+    const char *message = archive_error_string(a);
+    throw std::runtime_error(message != nullptr ? message : "can't read archive");
+}
+
+bool archive_reader::next(std::string &name)
+{
+    for (;;) {
+        int status = archive_read_next_header(a, &entry);
+        if (status == ARCHIVE_EOF) {
+            return false;
+        } else if (status < ARCHIVE_WARN) {
+            fail();
+        }
+
+        if (archive_entry_filetype(entry) == AE_IFREG) {
+            const char *path = archive_entry_pathname(entry);
+            name = path != nullptr ? path : "";
+            return true;
+        }
+    }
+}
+
+std::optional<std::uint64_t> archive_reader::size() const
+{
+    if (entry == nullptr || !archive_entry_size_is_set(entry) || archive_entry_size(entry) < 0) {
+        return std::nullopt;
+    }
+
+    return archive_entry_size(entry);
+}
+
+bool archive_reader::read(std::vector<char> &contents, std::uint64_t limit)
+{
+    contents.clear();
+
+    // The size in the header is only a hint (some formats don't record
+    // it), so reading goes on until libarchive says the member is done.
+    for (;;) {
+        std::size_t filled = contents.size();
+        if (filled > limit) {
+            return false;
+        }
+
+        // One byte more than the limit, to see whether there's more.
+        contents.resize(std::min<std::uint64_t>(std::max<std::size_t>(filled * 2, 64 * 1024), limit + 1));
+
+        la_ssize_t n = archive_read_data(a, contents.data() + filled, contents.size() - filled);
+        if (n < 0) {
+            fail();
+        }
+
+        contents.resize(filled + n);
+        if (n == 0) {
+            return true;
+        }
+    }
+}
@@ -0,0 +1,76 @@
+/*-
+ * Copyright (c) 2023 Chris Spiegel
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef OPENMPT_CHARSET_ARCHIVE_HPP
+#define OPENMPT_CHARSET_ARCHIVE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+struct archive;
+
+// Whether the data starts like one of the archive formats archive_reader
+// can list: ZIP, 7z, LHA/LZH or RAR.
+bool looks_like_archive(const void *data, std::size_t size);
+
+// The regular files in an archive held in memory, decompressed one at a
+// time with libarchive. Nothing is written to disk.
+//
+// Errors are reported by throwing std::runtime_error.
+class archive_reader {
+public:
+    // Members bigger than this are skipped rather than decompressed.
+    static constexpr std::uint64_t max_member_size = 256 * 1024 * 1024;
+
+    archive_reader(const void *data, std::size_t size);
+    ~archive_reader();
+
+    archive_reader(const archive_reader &) = delete;
+    archive_reader &operator=(const archive_reader &) = delete;
+
+    // Moves on to the next regular file, setting name to its path within
+    // the archive. Returns false at the end of the archive.
+    bool next(std::string &name);
+
+    // The size of the current member, if the archive records it.
+    std::optional<std::uint64_t> size() const;
+
+    // Decompresses the current member into contents, replacing whatever
+    // was there, but keeping its capacity. Returns false, leaving the
+    // rest of the member unread, if it turns out to be bigger than limit.
+    bool read(std::vector<char> &contents, std::uint64_t limit = max_member_size);
+
+private:
+    [[noreturn]] void fail();
+
+    struct archive *a;
+    struct archive_entry *entry = nullptr;
+};
+
+#endif
@@ -0,0 +1,200 @@
+/*-
+ * Copyright (c) 2023 Chris Spiegel
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+// Compares the table-driven CP437 conversion against the original
+// approach of decoding to codepoints with std::wstring_convert, mapping
+// each one, and encoding back to UTF-8; and the in-tree UTF-8 codec
+// against std::wstring_convert on its own.
+
+#include <algorithm>
+#include <codecvt>
+#include <cstdint>
+#include <locale>
+#include <span>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "../cp437.hpp"
+#include "../utf8.hpp"
+#include "message.hpp"
+
+static std::vector<std::uint32_t> wstring_utf8_to_codepoints(const std::string &s)
+{
+    std::wstring_convert<std::codecvt_utf8<char32_t>, char32_t> converter;
+    std::u32string utf32 = converter.from_bytes(s);
+
+    return {utf32.begin(), utf32.end()};
+}
+
+static std::string wstring_codepoints_to_utf8(const std::vector<std::uint32_t> &codepoints)
+{
+    std::wstring_convert<std::codecvt_utf8<char32_t>, char32_t> converter;
+    std::u32string utf32(codepoints.begin(), codepoints.end());
+
+    return converter.to_bytes(utf32);
+}
+
+// Whole strings through the in-tree codec, the same way; nothing outside
+// this benchmark needs them.
+static void utf8_to_codepoints(std::string_view s, std::vector<std::uint32_t> &out)
+{
+    auto p = reinterpret_cast<const unsigned char *>(s.data());
+    auto end = p + s.size();
+
+    out.clear();
+    out.reserve(s.size());
+
+    while (p != end) {
+        std::size_t n = ascii_length(reinterpret_cast<const char *>(p), end - p);
+        out.insert(out.end(), p, p + n);
+        p += n;
+
+        if (p != end) {
+            out.push_back(utf8_decode(p, end));
+        }
+    }
+}
+
+static void codepoints_to_utf8(std::span<const std::uint32_t> codepoints, std::string &out)
+{
+    out.resize(codepoints.size() * 4);
+
+    char *dst = out.data();
+    std::size_t i = 0;
+
+    while (i < codepoints.size()) {
+        while (i < codepoints.size() && codepoints[i] < 0x80) {
+            *dst++ = char(codepoints[i++]);
+        }
+
+        if (i < codepoints.size()) {
+            dst += utf8_encode(codepoints[i++], dst);
+        }
+    }
+
+    out.resize(dst - out.data());
+}
+
+static std::string reference_convert(const std::string &message)
+{
+    auto codepoints = wstring_utf8_to_codepoints(message);
+    std::vector<std::uint32_t> converted;
+
+    std::transform(codepoints.begin(), codepoints.end(), std::back_inserter(converted), cp437_to_unicode);
+
+    return wstring_codepoints_to_utf8(converted);
+}
+
+static void BM_reference_convert(benchmark::State &state)
+{
+    auto message = make_message(state.range(0), state.range(1));
+
+    for (auto _ : state) {
+        auto converted = reference_convert(message);
+        benchmark::DoNotOptimize(converted);
+    }
+
+    state.SetBytesProcessed(state.iterations() * message.size());
+}
+
+static void BM_table_convert(benchmark::State &state)
+{
+    auto message = make_message(state.range(0), state.range(1));
+    std::string converted;
+
+    if (reference_convert(message) != (cp437_convert(message, converted), converted)) {
+        state.SkipWithError("table conversion differs from reference");
+        return;
+    }
+
+    for (auto _ : state) {
+        cp437_convert(message, converted);
+        benchmark::DoNotOptimize(converted);
+    }
+
+    state.SetBytesProcessed(state.iterations() * message.size());
+}
+
+static void BM_wstring_decode(benchmark::State &state)
+{
+    auto message = make_message(state.range(0), state.range(1));
+
+    for (auto _ : state) {
+        auto codepoints = wstring_utf8_to_codepoints(message);
+        benchmark::DoNotOptimize(codepoints);
+    }
+
+    state.SetBytesProcessed(state.iterations() * message.size());
+}
+
+static void BM_utf8_decode(benchmark::State &state)
+{
+    auto message = make_message(state.range(0), state.range(1));
+    std::vector<std::uint32_t> codepoints;
+
+    for (auto _ : state) {
+        utf8_to_codepoints(message, codepoints);
+        benchmark::DoNotOptimize(codepoints);
+    }
+
+    state.SetBytesProcessed(state.iterations() * message.size());
+}
+
+static void BM_wstring_encode(benchmark::State &state)
+{
+    auto message = make_message(state.range(0), state.range(1));
+    auto codepoints = wstring_utf8_to_codepoints(message);
+
+    for (auto _ : state) {
+        auto encoded = wstring_codepoints_to_utf8(codepoints);
+        benchmark::DoNotOptimize(encoded);
+    }
+
+    state.SetBytesProcessed(state.iterations() * message.size());
+}
+
+static void BM_utf8_encode(benchmark::State &state)
+{
+    auto message = make_message(state.range(0), state.range(1));
+    auto codepoints = wstring_utf8_to_codepoints(message);
+    std::string encoded;
+
+    for (auto _ : state) {
+        codepoints_to_utf8(codepoints, encoded);
+        benchmark::DoNotOptimize(encoded);
+    }
+
+    state.SetBytesProcessed(state.iterations() * message.size());
+}
+
+BENCHMARK(BM_reference_convert)->MESSAGE_ARGS;
+BENCHMARK(BM_table_convert)->MESSAGE_ARGS;
+BENCHMARK(BM_wstring_decode)->MESSAGE_ARGS;
+BENCHMARK(BM_utf8_decode)->MESSAGE_ARGS;
+BENCHMARK(BM_wstring_encode)->MESSAGE_ARGS;
+BENCHMARK(BM_utf8_encode)->MESSAGE_ARGS;
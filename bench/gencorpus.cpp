@@ -0,0 +1,273 @@
+/*-
+ * Copyright (c) 2023 Chris Spiegel
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+// Writes a directory of small synthetic modules for benchmarking. IT files
+// carry a song message of the requested size; S3M and XM have no song
+// message, so their text goes into sample and instrument names instead.
+// In every format about density percent of the text is high-half CP437.
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <getopt.h>
+
+using bytes = std::vector<std::uint8_t>;
+
+static std::mt19937 rng(1);
+
+static void put16(bytes &b, std::size_t offset, std::uint16_t n)
+{
+    b[offset] = n & 0xFF;
+    b[offset + 1] = n >> 8;
+}
+
+static void put32(bytes &b, std::size_t offset, std::uint32_t n)
+{
+    put16(b, offset, n & 0xFFFF);
+    put16(b, offset + 2, n >> 16);
+}
+
+static void put_text(bytes &b, std::size_t offset, std::string_view text)
+{
+    std::memcpy(&b[offset], text.data(), text.size());
+}
+
+// Text of the given length in lines of at most width characters, each
+// ended by eol.
+static std::string make_text(std::size_t size, int density, std::size_t width, char eol)
+{
+    std::uniform_int_distribution<int> percent(0, 99);
+    std::uniform_int_distribution<int> printable(0x20, 0x7E);
+    std::uniform_int_distribution<int> high(0x80, 0xFF);
+    std::string text;
+
+    while (text.size() < size) {
+        for (std::size_t col = 0; col < width && text.size() < size; col++) {
+            text += char(percent(rng) < density ? high(rng) : printable(rng));
+        }
+        if (eol != '\0' && text.size() < size) {
+            text += eol;
+        }
+    }
+
+    return text;
+}
+
+static bytes make_it(std::size_t size, int density)
+{
+    auto message = make_text(size, density, 80, '\r');
+    bytes b(192 + 2);
+
+    put_text(b, 0, "IMPM");
+    put_text(b, 4, "benchmark");
+    put16(b, 32, 2);        // orders
+    put16(b, 40, 0x0214);   // created with
+    put16(b, 42, 0x0214);   // compatible with
+    put16(b, 44, 0x0009);   // stereo, linear slides
+    put16(b, 46, 0x0001);   // song message attached
+    b[48] = 128;            // global volume
+    b[49] = 48;             // mix volume
+    b[50] = 6;              // speed
+    b[51] = 125;            // tempo
+    b[52] = 128;            // separation
+    put16(b, 54, message.size() + 1);
+    put32(b, 56, b.size());
+    for (int i = 0; i < 64; i++) {
+        b[64 + i] = 32;
+        b[128 + i] = 64;
+    }
+    b[192] = 0xFF;
+    b[193] = 0xFF;
+
+    b.insert(b.end(), message.begin(), message.end());
+    b.push_back(0);
+
+    return b;
+}
+
+// S3M sample names are 28 bytes; as many samples as are needed to hold
+// the text, up to the format's limit of 99.
+static bytes make_s3m(std::size_t size, int density)
+{
+    auto text = make_text(std::min<std::size_t>(size, 27 * 99), density, 27, '\0');
+    std::size_t samples = (text.size() + 26) / 27;
+    std::size_t header = 96 + 2 + samples * 2;
+    std::size_t first = (header + 15) / 16 * 16;
+    bytes b(first + samples * 80);
+
+    put_text(b, 0, "benchmark");
+    b[28] = 0x1A;
+    b[29] = 16;
+    put16(b, 32, 2);        // orders
+    put16(b, 34, samples);
+    put16(b, 40, 0x1320);   // Scream Tracker 3.20
+    put16(b, 42, 2);        // unsigned samples
+    put_text(b, 44, "SCRM");
+    b[48] = 64;             // global volume
+    b[49] = 6;              // speed
+    b[50] = 125;            // tempo
+    b[51] = 0xB0;           // stereo, master volume
+    for (int i = 0; i < 32; i++) {
+        b[64 + i] = i < 4 ? i : 0xFF;
+    }
+    b[96] = 0xFF;
+    b[97] = 0xFF;
+
+    for (std::size_t i = 0; i < samples; i++) {
+        std::size_t offset = first + i * 80;
+        put16(b, 98 + i * 2, offset / 16);
+
+        b[offset] = 1;
+        b[offset + 28] = 64;
+        put32(b, offset + 32, 8363);
+        put_text(b, offset + 48, std::string_view(text).substr(i * 27, 27));
+        put_text(b, offset + 76, "SCRS");
+    }
+
+    return b;
+}
+
+// XM instrument names are 22 bytes; instruments without samples are the
+// smallest possible.
+static bytes make_xm(std::size_t size, int density)
+{
+    auto text = make_text(std::min<std::size_t>(size, 22 * 128), density, 22, '\0');
+    std::size_t instruments = (text.size() + 21) / 22;
+    bytes b(60 + 276);
+
+    put_text(b, 0, "Extended Module: benchmark");
+    b[37] = 0x1A;
+    put_text(b, 38, "synthetic");
+    put16(b, 58, 0x0104);
+    put32(b, 60, 276);
+    put16(b, 64, 1);        // song length
+    put16(b, 68, 4);        // channels
+    put16(b, 72, instruments);
+    put16(b, 74, 1);        // linear frequency table
+    put16(b, 76, 6);        // speed
+    put16(b, 78, 125);      // tempo
+
+    for (std::size_t i = 0; i < instruments; i++) {
+        bytes instrument(29);
+
+        put32(instrument, 0, 29);
+        put_text(instrument, 4, std::string_view(text).substr(i * 22, 22));
+        b.insert(b.end(), instrument.begin(), instrument.end());
+    }
+
+    return b;
+}
+
+static void usage()
+{
+    std::cerr << "usage: gencorpus [-n count] [-s size] [-d density] [-t it,s3m,xm] directory" << std::endl;
+    std::exit(1);
+}
+
+static unsigned long parse_number(const char *arg)
+{
+    char *end;
+    unsigned long n = std::strtoul(arg, &end, 10);
+
+    if (*arg == '\0' || *end != '\0') {
+        usage();
+    }
+
+    return n;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long count = 1000;
+    unsigned long size = 2048;
+    unsigned long density = 5;
+    std::vector<std::string> types;
+    int ch;
+
+    while ((ch = getopt(argc, argv, "d:n:s:t:")) != -1) {
+        switch (ch) {
+        case 'd':
+            density = parse_number(optarg);
+            break;
+        case 'n':
+            count = parse_number(optarg);
+            break;
+        case 's':
+            size = std::min(parse_number(optarg), 65534ul);
+            break;
+        case 't':
+            for (std::string_view list = optarg; !list.empty();) {
+                auto comma = list.find(',');
+                types.emplace_back(list.substr(0, comma));
+                list.remove_prefix(comma == std::string_view::npos ? list.size() : comma + 1);
+            }
+            break;
+        default:
+            usage();
+        }
+    }
+
+    if (optind + 1 != argc) {
+        usage();
+    }
+
+    if (types.empty()) {
+        types = {"it", "s3m", "xm"};
+    }
+
+    for (unsigned long i = 0; i < count; i++) {
+        const auto &type = types[i % types.size()];
+        bytes file;
+
+        if (type == "it") {
+            file = make_it(size, density);
+        } else if (type == "s3m") {
+            file = make_s3m(size, density);
+        } else if (type == "xm") {
+            file = make_xm(size, density);
+        } else {
+            std::cerr << "unknown type: " << type << std::endl;
+            return 1;
+        }
+
+        auto filename = std::string(argv[optind]) + "/" + std::to_string(i) + "." + type;
+        std::ofstream out(filename, std::ios::binary);
+        if (!out.write(reinterpret_cast<const char *>(file.data()), file.size())) {
+            std::cerr << "can't write " << filename << ": " << std::strerror(errno) << std::endl;
+            return 1;
+        }
+    }
+
+    return 0;
+}
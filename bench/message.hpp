@@ -0,0 +1,63 @@
+/*-
+ * Copyright (c) 2023 Chris Spiegel
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef OPENMPT_CHARSET_BENCH_MESSAGE_HPP
+#define OPENMPT_CHARSET_BENCH_MESSAGE_HPP
+
+#include <random>
+#include <string>
+
+// A message of roughly the given size, as libopenmpt would hand it over:
+// 80-column lines where about density percent of the characters are
+// high-half CP437 bytes (decoded as Latin-1, so two bytes of UTF-8 each).
+inline std::string make_message(std::size_t size, int density)
+{
+    std::mt19937 rng(size * 101 + density);
+    std::uniform_int_distribution<int> percent(0, 99);
+    std::uniform_int_distribution<int> printable(0x20, 0x7E);
+    std::uniform_int_distribution<int> high(0x80, 0xFF);
+    std::string message;
+
+    while (message.size() < size) {
+        for (int col = 0; col < 80; col++) {
+            if (percent(rng) < density) {
+                int c = high(rng);
+                message += char(0xC0 | (c >> 6));
+                message += char(0x80 | (c & 0x3F));
+            } else {
+                message += char(printable(rng));
+            }
+        }
+        message += '\n';
+    }
+
+    return message;
+}
+
+// Message sizes crossed with CP437 densities, in percent.
+#define MESSAGE_ARGS ArgsProduct({{256, 4096, 65536}, {0, 5, 50}})
+
+#endif
@@ -0,0 +1,129 @@
+/*-
+ * Copyright (c) 2023 Chris Spiegel
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+// Benchmarks for the pieces of text handling which run for every line of
+// every message: single-codepoint mapping, the quick scan, line splitting
+// and the column count used for padding.
+
+#include <cstdint>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "../cp437.hpp"
+#include "../lines.hpp"
+#include "../utf8.hpp"
+#include "../width.hpp"
+#include "message.hpp"
+
+static void BM_cp437_to_unicode(benchmark::State &state)
+{
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<std::uint32_t> dist(0, 0x17F);
+    std::vector<std::uint32_t> codepoints(state.range(0));
+
+    for (auto &c : codepoints) {
+        c = dist(rng);
+    }
+
+    for (auto _ : state) {
+        for (auto &c : codepoints) {
+            c = cp437_to_unicode(c);
+        }
+        benchmark::DoNotOptimize(codepoints.data());
+        benchmark::ClobberMemory();
+    }
+
+    state.SetItemsProcessed(state.iterations() * codepoints.size());
+}
+
+static void BM_cp437_needs_remap(benchmark::State &state)
+{
+    auto message = make_message(state.range(0), state.range(1));
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(cp437_needs_remap(message));
+    }
+
+    state.SetBytesProcessed(state.iterations() * message.size());
+}
+
+static void BM_line_splitter(benchmark::State &state)
+{
+    auto message = make_message(state.range(0), state.range(1));
+
+    for (auto _ : state) {
+        line_splitter lines(message);
+        while (!lines.done()) {
+            benchmark::DoNotOptimize(lines.next());
+        }
+    }
+
+    state.SetBytesProcessed(state.iterations() * message.size());
+}
+
+static void BM_line_pairs(benchmark::State &state)
+{
+    auto message = make_message(state.range(0), state.range(1));
+    std::string converted;
+
+    cp437_convert(message, converted);
+
+    for (auto _ : state) {
+        for (auto pair : line_pairs(message, converted)) {
+            benchmark::DoNotOptimize(pair);
+        }
+    }
+
+    state.SetBytesProcessed(state.iterations() * message.size());
+}
+
+static void BM_display_width(benchmark::State &state)
+{
+    auto message = make_message(state.range(0), state.range(1));
+    std::vector<std::string_view> lines;
+
+    for (line_splitter splitter(message); !splitter.done();) {
+        lines.push_back(splitter.next());
+    }
+
+    for (auto _ : state) {
+        for (auto line : lines) {
+            benchmark::DoNotOptimize(display_width(line));
+        }
+    }
+
+    state.SetBytesProcessed(state.iterations() * message.size());
+}
+
+BENCHMARK(BM_cp437_to_unicode)->Arg(4096);
+BENCHMARK(BM_cp437_needs_remap)->MESSAGE_ARGS;
+BENCHMARK(BM_line_splitter)->MESSAGE_ARGS;
+BENCHMARK(BM_line_pairs)->MESSAGE_ARGS;
+BENCHMARK(BM_display_width)->MESSAGE_ARGS;
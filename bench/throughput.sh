@@ -0,0 +1,35 @@
+#!/bin/sh
+#
+# usage: throughput.sh program corpus jobs...
+#
+# Checks every file in the corpus once per job count, reporting the best
+# of three runs in files and megabytes per second.
+
+set -e
+
+program=$1
+corpus=$2
+shift 2
+
+files=$(find "$corpus" -type f | wc -l)
+bytes=$(find "$corpus" -type f -exec cat {} + | wc -c)
+
+printf '%6s %12s %10s\n' jobs files/s MB/s
+
+for jobs in "$@"; do
+    best=
+    for run in 1 2 3; do
+        start=$(date +%s%N)
+        "$program" -j "$jobs" "$corpus" > /dev/null 2>&1
+        end=$(date +%s%N)
+        ns=$((end - start))
+        if [ -z "$best" ] || [ "$ns" -lt "$best" ]; then
+            best=$ns
+        fi
+    done
+
+    awk -v jobs="$jobs" -v files="$files" -v bytes="$bytes" -v ns="$best" 'BEGIN {
+        s = ns / 1e9
+        printf "%6d %12.1f %10.2f\n", jobs, files / s, bytes / 1e6 / s
+    }'
+done
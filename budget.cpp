@@ -0,0 +1,103 @@
+/*-
+ * Copyright (c) 2023 Chris Spiegel
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <algorithm>
+
+#include "budget.hpp"
+
+std::size_t memory_budget::acquire(std::size_t bytes)
+{
+    std::unique_lock lock(mutex);
+
+    available.wait(lock, [&] { return checking == 0 || room(bytes); });
+
+    used += bytes;
+    checking += bytes;
+    peak_used = std::max(peak_used, used);
+    return bytes;
+}
+
+bool memory_budget::acquire_ahead(std::size_t bytes, bool wait)
+{
+    std::unique_lock lock(mutex);
+
+    if (wait) {
+        available.wait(lock, [&] { return used == 0 || room(bytes); });
+    } else if (used != 0 && !room(bytes)) {
+        return false;
+    }
+
+    used += bytes;
+    peak_used = std::max(peak_used, used);
+    return true;
+}
+
+void memory_budget::release(std::size_t bytes, bool read_ahead)
+{
+    {
+        std::lock_guard lock(mutex);
+        used -= bytes;
+        if (!read_ahead) {
+            checking -= bytes;
+        }
+
+        if (on_release) {
+            on_release();
+        }
+    }
+
+    available.notify_all();
+}
+
+void memory_budget::watch(std::function<void()> released)
+{
+    std::lock_guard lock(mutex);
+    on_release = std::move(released);
+}
+
+std::unique_ptr<memory_budget::reservation> memory_budget::reservation::ahead(memory_budget &budget, std::size_t bytes, bool wait)
+{
+    if (!budget.acquire_ahead(bytes, wait)) {
+        return nullptr;
+    }
+
+    return std::unique_ptr<reservation>(new reservation(budget, bytes, true));
+}
+
+void memory_budget::reservation::hand_off()
+{
+    if (read_ahead) {
+        std::lock_guard lock(budget.mutex);
+        budget.checking += bytes;
+        read_ahead = false;
+    }
+}
+
+std::size_t memory_budget::peak() const
+{
+    std::lock_guard lock(mutex);
+    return peak_used;
+}
@@ -0,0 +1,102 @@
+/*-
+ * Copyright (c) 2023 Chris Spiegel
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef OPENMPT_CHARSET_BUDGET_HPP
+#define OPENMPT_CHARSET_BUDGET_HPP
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+// A limit on the memory taken up by the files being worked on at once.
+// Each file reserves what it expects to need before it's loaded, and
+// waits if that would take the total over the budget, so that a handful
+// of huge files can't all end up in memory together.
+//
+// A file which is bigger than the whole budget is still let through, but
+// only once no other file being checked holds a reservation, so that it
+// can't wait forever.
+//
+// Files read ahead of time hold reservations too, from before the read
+// until the buffer is freed. Those mustn't ever stop a file from being
+// checked: the files read ahead may be waiting for the very worker that's
+// blocked. So a file being checked only waits on the other files being
+// checked, and read-ahead only gets what's left over.
+class memory_budget {
+public:
+    class reservation {
+    public:
+        reservation(memory_budget &budget, std::size_t bytes) : budget(budget), bytes(budget.acquire(bytes)) {}
+        ~reservation() { budget.release(bytes, read_ahead); }
+
+        reservation(const reservation &) = delete;
+        reservation &operator=(const reservation &) = delete;
+
+        // Reserves bytes for a file about to be read ahead. If wait is
+        // false, this gives up and returns nullptr when there's no room;
+        // otherwise it waits for room.
+        static std::unique_ptr<reservation> ahead(memory_budget &budget, std::size_t bytes, bool wait);
+
+        // Counts a read-ahead reservation as a file being checked, once
+        // the file has been handed to a worker.
+        void hand_off();
+
+    private:
+        reservation(memory_budget &budget, std::size_t bytes, bool) : budget(budget), bytes(bytes), read_ahead(true) {}
+
+        memory_budget &budget;
+        std::size_t bytes;
+        bool read_ahead = false;
+    };
+
+    explicit memory_budget(std::size_t limit) : limit(limit) {}
+
+    std::size_t peak() const;
+
+    // Called, with a lock held, whenever memory is given back, for
+    // read-ahead which can't just block waiting for room; an empty
+    // function stops the calls.
+    void watch(std::function<void()> released);
+
+private:
+    std::size_t acquire(std::size_t bytes);
+    bool acquire_ahead(std::size_t bytes, bool wait);
+    void release(std::size_t bytes, bool read_ahead);
+    bool room(std::size_t bytes) const { return bytes <= limit - std::min(used, limit); }
+
+    const std::size_t limit;
+    mutable std::mutex mutex;
+    std::condition_variable available;
+    std::function<void()> on_release;
+    std::size_t used = 0;
+    std::size_t checking = 0;
+    std::size_t peak_used = 0;
+};
+
+#endif
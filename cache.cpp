@@ -0,0 +1,322 @@
+/*-
+ * Copyright (c) 2023 Chris Spiegel
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "cache.hpp"
+#include "hash.hpp"
+
+static constexpr std::string_view magic = "OMCCACHE";
+static constexpr std::size_t flush_size = 64 * 1024;
+
+namespace {
+void put32(std::string &s, std::uint32_t v)
+{
+    for (int i = 0; i < 4; i++) {
+        s.push_back(char(v >> (i * 8)));
+    }
+}
+
+void put64(std::string &s, std::uint64_t v)
+{
+    for (int i = 0; i < 8; i++) {
+        s.push_back(char(v >> (i * 8)));
+    }
+}
+
+// Reads little-endian values from a buffer, failing (rather than reading
+// past the end) once the buffer runs out.
+class reader {
+public:
+    explicit reader(std::string_view data) : data(data) {}
+
+    bool get32(std::uint32_t &v) { return get(v, 4); }
+    bool get64(std::uint64_t &v) { return get(v, 8); }
+
+    bool get8(std::uint8_t &v)
+    {
+        if (data.empty()) {
+            return false;
+        }
+        v = data[0];
+        data.remove_prefix(1);
+        return true;
+    }
+
+    bool bytes(std::string_view &v, std::size_t n)
+    {
+        if (data.size() < n) {
+            return false;
+        }
+        v = data.substr(0, n);
+        data.remove_prefix(n);
+        return true;
+    }
+
+    bool string(std::string_view &v)
+    {
+        std::uint32_t n;
+        return get32(n) && bytes(v, n);
+    }
+
+    std::size_t remaining() const { return data.size(); }
+
+private:
+    template <typename T>
+    bool get(T &v, int n)
+    {
+        if (data.size() < std::size_t(n)) {
+            return false;
+        }
+        v = 0;
+        for (int i = 0; i < n; i++) {
+            v |= T(static_cast<unsigned char>(data[i])) << (i * 8);
+        }
+        data.remove_prefix(n);
+        return true;
+    }
+
+    std::string_view data;
+};
+
+void encode_record(std::string &out, std::string_view path, const file_key &key, check_outcome outcome, std::string_view report)
+{
+    std::string body;
+
+    put64(body, key.size);
+    put64(body, key.mtime);
+    put64(body, key.hash);
+    body.push_back(char(outcome));
+    put32(body, path.size());
+    body.append(path);
+    put32(body, report.size());
+    body.append(report);
+
+    put32(out, body.size());
+    out.append(body);
+    put32(out, std::uint32_t(xxh64(body)));
+}
+
+void write_all(int fd, std::string_view s)
+{
+    while (!s.empty()) {
+        ssize_t n = write(fd, s.data(), s.size());
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::system_error(errno, std::generic_category(), "can't write cache");
+        }
+        s.remove_prefix(n);
+    }
+}
+}
+
+result_cache::result_cache(const std::string &path, std::string_view signature) : path(path)
+{
+    if (!load(signature)) {
+        start(signature);
+        return;
+    }
+
+    if (superseded > entries.size()) {
+        compact(signature);
+        return;
+    }
+
+    fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd == -1) {
+        throw std::system_error(errno, std::generic_category(), "can't open cache " + path);
+    }
+
+    // Drop anything after the last good record, so new records don't end
+    // up behind a damaged one.
+    if (ftruncate(fd, valid_size) == -1 || lseek(fd, 0, SEEK_END) == -1) {
+        throw std::system_error(errno, std::generic_category(), "can't open cache " + path);
+    }
+}
+
+result_cache::~result_cache()
+{
+    try {
+        flush();
+    } catch (const std::exception &) {
+    }
+
+    if (fd != -1) {
+        close(fd);
+    }
+}
+
+// Read the existing log, if any. Returns false if there's nothing usable,
+// either because there is no log yet or because it was written with a
+// different signature.
+bool result_cache::load(std::string_view signature)
+{
+    try {
+        contents = std::make_unique<input_file>(path, true);
+    } catch (const std::system_error &e) {
+        if (e.code() == std::errc::no_such_file_or_directory) {
+            return false;
+        }
+        throw;
+    }
+
+    reader r({static_cast<const char *>(contents->data()), contents->size()});
+    std::string_view header, stored_signature;
+
+    if (!r.bytes(header, magic.size()) || header != magic || !r.string(stored_signature) || stored_signature != signature) {
+        return false;
+    }
+
+    for (;;) {
+        valid_size = contents->size() - r.remaining();
+
+        std::string_view body, path;
+        std::uint32_t check;
+
+        if (!r.string(body) || !r.get32(check) || check != std::uint32_t(xxh64(body))) {
+            break;
+        }
+
+        reader b(body);
+        entry e;
+        std::uint64_t mtime;
+        std::uint8_t outcome;
+
+        if (!b.get64(e.key.size) || !b.get64(mtime) || !b.get64(e.key.hash) || !b.get8(outcome) ||
+            outcome > std::uint8_t(check_outcome::difference) || !b.string(path) || !b.string(e.report)) {
+            break;
+        }
+
+        e.key.mtime = mtime;
+        e.outcome = check_outcome(outcome);
+
+        auto [it, inserted] = entries.insert_or_assign(path, e);
+        if (!inserted) {
+            superseded++;
+        }
+    }
+
+    return true;
+}
+
+// Rewrite the log with only the live records, replacing the old one in a
+// single rename.
+void result_cache::compact(std::string_view signature)
+{
+    auto tmp = path + ".tmp";
+
+    fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (fd == -1) {
+        throw std::system_error(errno, std::generic_category(), "can't create cache " + tmp);
+    }
+
+    std::string out(magic);
+    put32(out, signature.size());
+    out.append(signature);
+
+    for (const auto &[path, e] : entries) {
+        encode_record(out, path, e.key, e.outcome, e.report);
+        if (out.size() >= flush_size) {
+            write_all(fd, out);
+            out.clear();
+        }
+    }
+
+    write_all(fd, out);
+
+    if (rename(tmp.c_str(), path.c_str()) == -1) {
+        throw std::system_error(errno, std::generic_category(), "can't replace cache " + path);
+    }
+
+    superseded = 0;
+}
+
+// Start a new, empty log.
+void result_cache::start(std::string_view signature)
+{
+    entries.clear();
+
+    fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (fd == -1) {
+        throw std::system_error(errno, std::generic_category(), "can't create cache " + path);
+    }
+
+    std::string header(magic);
+    put32(header, signature.size());
+    header.append(signature);
+    write_all(fd, header);
+}
+
+std::optional<result_cache::entry> result_cache::lookup(std::string_view path, const file_key &key)
+{
+    auto it = entries.find(path);
+
+    if (it == entries.end()) {
+        new_files++;
+        return std::nullopt;
+    }
+
+    if (it->second.key != key) {
+        changed_files++;
+        return std::nullopt;
+    }
+
+    hits++;
+    return it->second;
+}
+
+void result_cache::store(std::string_view path, const file_key &key, check_outcome outcome, std::string_view report)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    encode_record(pending, path, key, outcome, report);
+    stored++;
+
+    if (pending.size() >= flush_size) {
+        flush();
+    }
+}
+
+void result_cache::flush()
+{
+    write_all(fd, pending);
+    pending.clear();
+}
+
+result_cache::statistics result_cache::stats() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    return {hits, new_files, changed_files, stored};
+}
@@ -0,0 +1,132 @@
+/*-
+ * Copyright (c) 2023 Chris Spiegel
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef OPENMPT_CHARSET_CACHE_HPP
+#define OPENMPT_CHARSET_CACHE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "inputfile.hpp"
+
+// What checking a file came to.
+enum class check_outcome : std::uint8_t {
+    no_message,
+    no_difference,
+    difference,
+};
+
+// Identifies one version of a file's contents.
+struct file_key {
+    std::uint64_t size;
+    std::int64_t mtime;
+    std::uint64_t hash;
+
+    bool operator==(const file_key &) const = default;
+};
+
+// Results of earlier runs, so that files which haven't changed since can be
+// answered without loading them. The cache is an append-only log of
+// records, each holding a path, the key of the file's contents when it was
+// checked, the outcome, and the report that was printed. When a path
+// appears more than once, the last record wins; the log is compacted when
+// it is opened if superseded records outnumber live ones.
+//
+// The log starts with a signature describing the options which affect
+// reports. A log written with different options is thrown away rather
+// than replayed.
+//
+// File layout (all integers little-endian):
+//
+//   "OMCCACHE" u32:signature-length signature
+//   records:  u32:body-length body u32:check
+//   body:     u64:size i64:mtime u64:hash u8:outcome
+//             u32:path-length path u32:report-length report
+//
+// where check is the low 32 bits of the XXH64 of the body. A damaged or
+// incomplete record ends the log; everything from it onward is dropped.
+class result_cache {
+public:
+    struct entry {
+        file_key key;
+        check_outcome outcome;
+        std::string_view report;
+    };
+
+    struct statistics {
+        std::size_t hits;
+        std::size_t new_files;
+        std::size_t changed_files;
+        std::size_t written;
+    };
+
+    // Throws std::system_error or std::runtime_error if the cache can't
+    // be opened or created.
+    result_cache(const std::string &path, std::string_view signature);
+    ~result_cache();
+
+    result_cache(const result_cache &) = delete;
+    result_cache &operator=(const result_cache &) = delete;
+
+    // The stored result for path, if there is one and it was recorded
+    // for the same contents. Counts a hit or a miss.
+    std::optional<entry> lookup(std::string_view path, const file_key &key);
+
+    // Record a new result. Records are buffered and written in batches.
+    void store(std::string_view path, const file_key &key, check_outcome outcome, std::string_view report);
+
+    statistics stats() const;
+
+private:
+    bool load(std::string_view signature);
+    void compact(std::string_view signature);
+    void start(std::string_view signature);
+    void flush();
+
+    std::string path;
+    std::unique_ptr<input_file> contents;
+    std::unordered_map<std::string_view, entry> entries;
+    std::size_t superseded = 0;
+    std::size_t valid_size = 0;
+    int fd = -1;
+
+    mutable std::mutex mutex;
+    std::string pending;
+    std::size_t stored = 0;
+
+    std::atomic<std::size_t> hits{0};
+    std::atomic<std::size_t> new_files{0};
+    std::atomic<std::size_t> changed_files{0};
+};
+
+#endif
@@ -0,0 +1,98 @@
+/*-
+ * Copyright (c) 2023 Chris Spiegel
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+
+#include "charset.hpp"
+#include "codepages.hpp"
+#include "cp437.hpp"
+
+template <const codepage &CP>
+static constexpr charset make_charset(std::string_view name)
+{
+    return {
+        name,
+        [](std::uint32_t c) { return CP.to_unicode(c); },
+        codepage_needs_remap<CP>,
+        codepage_changes<CP>,
+        codepage_convert<CP>,
+        [](std::string_view in, char *out) { return codepage_convert_into<CP>(in, out); },
+        codepage_convert_line<CP>,
+    };
+}
+
+static constexpr std::array charsets = {
+    make_charset<cp437_codepage>("cp437"),
+    make_charset<cp850_codepage>("cp850"),
+    make_charset<iso8859_1_codepage>("iso-8859-1"),
+    make_charset<windows1252_codepage>("windows-1252"),
+    make_charset<mac_roman_codepage>("mac-roman"),
+};
+
+static constexpr std::array<std::pair<std::string_view, std::string_view>, 6> aliases = {{
+    {"ibm437", "cp437"},
+    {"ibm850", "cp850"},
+    {"latin1", "iso-8859-1"},
+    {"amiga", "iso-8859-1"},
+    {"cp1252", "windows-1252"},
+    {"macintosh", "mac-roman"},
+}};
+
+static bool equal_ignoring_case(std::string_view a, std::string_view b)
+{
+    return std::equal(a.begin(), a.end(), b.begin(), b.end(), [](unsigned char x, unsigned char y) {
+        return std::tolower(x) == std::tolower(y);
+    });
+}
+
+std::span<const charset> all_charsets()
+{
+    return charsets;
+}
+
+const charset *find_charset(std::string_view name)
+{
+    for (const auto &[alias, target] : aliases) {
+        if (equal_ignoring_case(name, alias)) {
+            name = target;
+        }
+    }
+
+    for (const auto &cs : charsets) {
+        if (equal_ignoring_case(name, cs.name)) {
+            return &cs;
+        }
+    }
+
+    return nullptr;
+}
+
+const charset &default_charset()
+{
+    return charsets[0];
+}
@@ -0,0 +1,84 @@
+/*-
+ * Copyright (c) 2023 Chris Spiegel
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef OPENMPT_CHARSET_CHARSET_HPP
+#define OPENMPT_CHARSET_CHARSET_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+
+#include "lines.hpp"
+
+// A codepage which can be chosen at run time. Each function is an
+// instantiation of the codepage templates, so the loops inside them are
+// specialized for that one table.
+struct charset {
+    std::string_view name;
+    std::uint32_t (*to_unicode)(std::uint32_t c);
+    bool (*needs_remap)(std::string_view s);
+    bool (*changes)(std::string_view s);
+    void (*convert)(std::string_view in, std::string &out);
+    std::size_t (*convert_into)(std::string_view in, char *out);
+    std::size_t (*convert_line)(std::string_view in, std::string &out);
+};
+
+std::span<const charset> all_charsets();
+
+// Looks up a charset by name or alias, ignoring case; nullptr if there is
+// no such charset.
+const charset *find_charset(std::string_view name);
+
+const charset &default_charset();
+
+// The diff-only check shared by openmpt-charset and the library: calls
+// changed(index, columns, line, converted) for each line of text which
+// conversion to cs changes, where index counts every line from 0 and
+// columns is the display width of line. Only the lines the quick scan
+// flags are converted, each into new_line, which is reused from one line
+// to the next; converted is a view of it, valid only during the call.
+template <typename Changed>
+void for_each_changed_line(const charset &cs, std::string_view text, std::string &new_line, Changed &&changed)
+{
+    line_splitter lines(text);
+
+    for (std::uint32_t index = 0; !lines.done(); index++) {
+        auto line = lines.next();
+
+        if (!cs.needs_remap(line)) {
+            continue;
+        }
+
+        auto columns = cs.convert_line(line, new_line);
+        if (line != new_line) {
+            changed(index, columns, line, std::string_view(new_line));
+        }
+    }
+}
+
+#endif
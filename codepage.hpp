@@ -0,0 +1,290 @@
+/*-
+ * Copyright (c) 2023 Chris Spiegel
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef OPENMPT_CHARSET_CODEPAGE_HPP
+#define OPENMPT_CHARSET_CODEPAGE_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#include "utf8.hpp"
+#include "width.hpp"
+
+// An 8-bit character set: the Unicode equivalent of each of its 256
+// characters, and a mask of characters which are left as they are
+// instead, such as newline, so that messages keep their line structure.
+struct codepage {
+    std::array<std::uint32_t, 256> codepoints;
+    std::array<std::uint64_t, 4> preserve;
+
+    constexpr bool preserves(std::uint32_t c) const
+    {
+        return (preserve[c / 64] >> (c % 64)) & 1;
+    }
+
+    constexpr std::uint32_t to_unicode(std::uint32_t c) const
+    {
+        return c >= codepoints.size() || preserves(c) ? c : codepoints[c];
+    }
+
+    // Whether every character in [first, last] comes out as itself.
+    constexpr bool identity(std::uint32_t first, std::uint32_t last) const
+    {
+        for (std::uint32_t c = first; c <= last; c++) {
+            if (to_unicode(c) != c) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    constexpr bool ascii_identity() const { return identity(0x00, 0x7F); }
+    constexpr bool printable_identity() const { return identity(0x20, 0x7E); }
+};
+
+inline constexpr std::array<std::uint64_t, 4> preserve_newline = {std::uint64_t(1) << 0x0A, 0, 0, 0};
+
+// A codepoint, already encoded as UTF-8.
+struct utf8_sequence {
+    std::uint8_t length;
+    char bytes[3];
+};
+
+// The UTF-8 encoding of what each codepoint below 256 becomes.
+constexpr std::array<utf8_sequence, 256> make_utf8_table(const codepage &cp)
+{
+    std::array<utf8_sequence, 256> table{};
+
+    for (std::uint32_t i = 0; i < table.size(); i++) {
+        char bytes[4] = {};
+        auto length = utf8_encode(cp.to_unicode(i), bytes);
+        table[i] = {std::uint8_t(length), {bytes[0], bytes[1], bytes[2]}};
+    }
+
+    return table;
+}
+
+template <const codepage &CP>
+inline constexpr auto codepage_utf8 = make_utf8_table(CP);
+
+// No entry in any table needs more than this many bytes, and neither does
+// a replacement character, which bounds the size of a conversion.
+inline constexpr std::size_t codepage_max_expansion = 3;
+
+// Whether any character of the UTF-8 string s could come out differently
+// after codepage_convert(). Most messages are plain printable ASCII, and
+// this lets them skip conversion entirely. For codepages which map all of
+// ASCII to itself, that's a matter of finding a non-ASCII byte; the
+// others (the DOS codepages, which have glyphs for control characters)
+// also look for control characters other than newline, and DEL. Either
+// way, this looks at 32 or 16 bytes at a time when it can.
+template <const codepage &CP>
+inline bool codepage_needs_remap(std::string_view s)
+{
+    static_assert(CP.to_unicode(0x0A) == 0x0A, "newline must be preserved");
+    static_assert(CP.printable_identity(), "the scan assumes printable ASCII is unchanged");
+
+    if constexpr (CP.ascii_identity()) {
+        return ascii_length(s.data(), s.size()) != s.size();
+    }
+
+    const char *p = s.data();
+    std::size_t n = s.size();
+    std::size_t i = 0;
+
+    // Bytes 0x80 and above are negative as signed chars, so "less than
+    // 0x20" catches them along with the control characters.
+#if defined(__AVX2__)
+    const __m256i space32 = _mm256_set1_epi8(0x20);
+    const __m256i newline32 = _mm256_set1_epi8(0x0A);
+    const __m256i del32 = _mm256_set1_epi8(0x7F);
+
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i));
+        __m256i low = _mm256_andnot_si256(_mm256_cmpeq_epi8(v, newline32), _mm256_cmpgt_epi8(space32, v));
+        if (_mm256_movemask_epi8(_mm256_or_si256(low, _mm256_cmpeq_epi8(v, del32))) != 0) {
+            return true;
+        }
+    }
+#endif
+
+#if defined(__SSE2__)
+    const __m128i space = _mm_set1_epi8(0x20);
+    const __m128i newline = _mm_set1_epi8(0x0A);
+    const __m128i del = _mm_set1_epi8(0x7F);
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+        __m128i low = _mm_andnot_si128(_mm_cmpeq_epi8(v, newline), _mm_cmplt_epi8(v, space));
+        if (_mm_movemask_epi8(_mm_or_si128(low, _mm_cmpeq_epi8(v, del))) != 0) {
+            return true;
+        }
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    for (; i + 16 <= n; i += 16) {
+        uint8x16_t v = vld1q_u8(reinterpret_cast<const std::uint8_t *>(p + i));
+        uint8x16_t low = vbicq_u8(vcltq_u8(v, vdupq_n_u8(0x20)), vceqq_u8(v, vdupq_n_u8(0x0A)));
+        uint8x16_t bad = vorrq_u8(vorrq_u8(low, vceqq_u8(v, vdupq_n_u8(0x7F))), vcgeq_u8(v, vdupq_n_u8(0x80)));
+        if (vmaxvq_u8(bad) != 0) {
+            return true;
+        }
+    }
+#endif
+
+    for (; i < n; i++) {
+        unsigned char c = p[i];
+        if (c >= 0x80 || CP.to_unicode(c) != c) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Which of the codepoints below 256 come out as something else.
+constexpr std::array<bool, 256> make_changes_table(const codepage &cp)
+{
+    std::array<bool, 256> table{};
+
+    for (std::uint32_t i = 0; i < table.size(); i++) {
+        table[i] = cp.to_unicode(i) != i;
+    }
+
+    return table;
+}
+
+template <const codepage &CP>
+inline constexpr auto codepage_changes_table = make_changes_table(CP);
+
+// Whether codepage_convert() would change s at all. Unlike
+// codepage_needs_remap(), this is exact: a character which the codepage
+// happens to map to itself doesn't count, while ill-formed UTF-8 (which
+// conversion replaces) does. It stops at the first character which
+// changes, so it's cheaper than converting whenever anything does.
+template <const codepage &CP>
+inline bool codepage_changes(std::string_view s)
+{
+    constexpr const auto &table = codepage_changes_table<CP>;
+
+    auto src = reinterpret_cast<const unsigned char *>(s.data());
+    auto end = src + s.size();
+
+    while (src != end) {
+        const unsigned char *start = src;
+        std::uint32_t c = *src < 0x80 ? *src++ : utf8_decode(src, end);
+
+        if (c < table.size()) {
+            if (table[c]) {
+                return true;
+            }
+        } else if (c == utf8_replacement && (src - start != 3 || std::memcmp(start, "\xEF\xBF\xBD", 3) != 0)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Reinterpret every codepoint below 256 in the UTF-8 string in as a
+// character of the codepage, writing the result, also UTF-8, to out,
+// which must have room for in.size() * codepage_max_expansion bytes.
+// Everything else is copied through untouched, except that ill-formed
+// UTF-8 is replaced as described in utf8.hpp. This does the job in a
+// single pass, without decoding to an intermediate codepoint buffer.
+// Returns the number of bytes written; if Measure is true, the display
+// width of in is added to columns along the way.
+template <const codepage &CP, bool Measure = false>
+inline std::size_t codepage_convert_into(std::string_view in, char *out, std::size_t *columns = nullptr)
+{
+    constexpr const auto &table = codepage_utf8<CP>;
+
+    auto src = reinterpret_cast<const unsigned char *>(in.data());
+    auto end = src + in.size();
+    char *dst = out;
+    std::size_t width = 0;
+
+    while (src != end) {
+        const unsigned char *start = src;
+        std::uint32_t c = *src < 0x80 ? *src++ : utf8_decode(src, end);
+
+        if constexpr (Measure) {
+            width += unicode_width(c);
+        }
+
+        if (c < table.size()) {
+            const auto &seq = table[c];
+            dst[0] = seq.bytes[0];
+            dst[1] = seq.bytes[1];
+            dst[2] = seq.bytes[2];
+            dst += seq.length;
+        } else if (c == utf8_replacement) {
+            dst += utf8_encode(c, dst);
+        } else {
+            std::memcpy(dst, start, src - start);
+            dst += src - start;
+        }
+    }
+
+    if constexpr (Measure) {
+        *columns += width;
+    }
+
+    return dst - out;
+}
+
+// The same, into a string, replacing its contents.
+template <const codepage &CP>
+inline void codepage_convert(std::string_view in, std::string &out)
+{
+    out.resize(in.size() * codepage_max_expansion);
+    out.resize(codepage_convert_into<CP>(in, out.data()));
+}
+
+// For a single line which is about to be printed: converts it as above,
+// and returns the display width of the original, worked out in the same
+// pass rather than by looking at the line again.
+template <const codepage &CP>
+inline std::size_t codepage_convert_line(std::string_view in, std::string &out)
+{
+    std::size_t columns = 0;
+
+    out.resize(in.size() * codepage_max_expansion);
+    out.resize(codepage_convert_into<CP, true>(in, out.data(), &columns));
+    return columns;
+}
+
+#endif
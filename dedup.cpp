@@ -0,0 +1,97 @@
+/*-
+ * Copyright (c) 2023 Chris Spiegel
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <algorithm>
+
+#include "dedup.hpp"
+#include "hash.hpp"
+
+text_dedup::key text_dedup::key_of(std::string_view text)
+{
+    return {xxh64(text), text};
+}
+
+std::shared_ptr<const text_result> text_dedup::find(const key &k) const
+{
+    const auto &s = shard_for(k);
+    std::lock_guard lock(s.mutex);
+
+    auto it = s.entries.find(k);
+    if (it == s.entries.end()) {
+        return nullptr;
+    }
+
+    hit_count++;
+    return it->second.result;
+}
+
+std::shared_ptr<const text_result> text_dedup::insert(const key &k, std::shared_ptr<const text_result> result)
+{
+    if (!grouping && stored.load(std::memory_order_relaxed) >= limit) {
+        return result;
+    }
+
+    auto &s = shard_for(k);
+    std::lock_guard lock(s.mutex);
+
+    auto it = s.entries.find(k);
+    if (it == s.entries.end()) {
+        it = s.entries.emplace(stored_key{k.hash, std::string(k.text)}, value{result, {}}).first;
+        stored += result->footprint() + k.text.size();
+    }
+
+    return it->second.result;
+}
+
+void text_dedup::add_file(const key &k, std::string_view filename)
+{
+    auto &s = shard_for(k);
+    std::lock_guard lock(s.mutex);
+
+    s.entries.find(k)->second.files.emplace_back(filename);
+}
+
+std::vector<text_dedup::group> text_dedup::groups() const
+{
+    std::vector<group> all;
+
+    for (const auto &s : shards) {
+        std::lock_guard lock(s.mutex);
+
+        for (const auto &[k, v] : s.entries) {
+            if (!v.files.empty()) {
+                all.push_back({v.result, v.files});
+            }
+        }
+    }
+
+    for (auto &g : all) {
+        std::sort(g.files.begin(), g.files.end());
+    }
+
+    std::sort(all.begin(), all.end(), [](const group &a, const group &b) { return a.files.front() < b.files.front(); });
+    return all;
+}
@@ -0,0 +1,187 @@
+/*-
+ * Copyright (c) 2023 Chris Spiegel
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef OPENMPT_CHARSET_DEDUP_HPP
+#define OPENMPT_CHARSET_DEDUP_HPP
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "cache.hpp"
+
+// What converting a piece of text (a message, or all of a module's fields
+// one per line) came to: the lines which have to be reported, each with
+// its index among the text's lines. Clearing keeps the storage.
+class text_result {
+public:
+    struct line {
+        std::uint32_t index;
+        std::size_t columns;
+        std::string_view original;
+        std::string_view converted;
+    };
+
+    check_outcome outcome = check_outcome::no_difference;
+
+    void clear()
+    {
+        outcome = check_outcome::no_difference;
+        buffer.clear();
+        entries.clear();
+    }
+
+    bool empty() const { return entries.empty(); }
+    std::size_t size() const { return entries.size(); }
+
+    // columns is the display width of original, or SIZE_MAX if unknown.
+    void add(std::uint32_t index, std::size_t columns, std::string_view original, std::string_view converted)
+    {
+        entries.push_back({index, columns, buffer.size(), original.size(), converted.size()});
+        buffer += original;
+        buffer += converted;
+    }
+
+    line operator[](std::size_t i) const
+    {
+        const auto &e = entries[i];
+        std::string_view text = buffer;
+        return {e.index, e.columns, text.substr(e.offset, e.original_size), text.substr(e.offset + e.original_size, e.converted_size)};
+    }
+
+    // Roughly how much memory the result takes up.
+    std::size_t footprint() const { return sizeof *this + buffer.capacity() + entries.capacity() * sizeof(entry); }
+
+private:
+    struct entry {
+        std::uint32_t index;
+        std::size_t columns;
+        std::size_t offset;
+        std::size_t original_size;
+        std::size_t converted_size;
+    };
+
+    std::string buffer;
+    std::vector<entry> entries;
+};
+
+// Results for text which has been seen before, found by its XXH64, so
+// that packs full of modules with the same greeting only have its
+// conversion done once. A copy of the text is kept with each result and
+// compared on every lookup, so that two texts with the same hash can
+// never be given each other's results. The map is split into shards,
+// each with its own lock, so that workers rarely wait for each other.
+//
+// Once the stored results add up to the size limit, no more are added,
+// unless files are being grouped: then every result has to be kept.
+//
+// When grouping, each result also remembers the names of the files it
+// was found in, for a summary at the end in place of the reports.
+class text_dedup {
+public:
+    // Refers to the text it was made from, which has to outlive it.
+    struct key {
+        std::uint64_t hash = 0;
+        std::string_view text;
+    };
+
+    struct group {
+        std::shared_ptr<const text_result> result;
+        std::vector<std::string> files;
+    };
+
+    text_dedup(std::size_t limit, bool grouping) : limit(limit), grouping(grouping) {}
+
+    static key key_of(std::string_view text);
+
+    std::shared_ptr<const text_result> find(const key &k) const;
+
+    // Stores result for k, unless another thread got there first, and
+    // returns whichever result is now stored; or returns result itself if
+    // the cache is full.
+    std::shared_ptr<const text_result> insert(const key &k, std::shared_ptr<const text_result> result);
+
+    // Records that filename had the text for k, which must have been
+    // inserted while grouping.
+    void add_file(const key &k, std::string_view filename);
+
+    // Every group with at least one file, each group's files in order of
+    // name, and the groups in order of their first file.
+    std::vector<group> groups() const;
+
+    std::size_t hits() const { return hit_count; }
+
+private:
+    struct stored_key {
+        std::uint64_t hash;
+        std::string text;
+    };
+
+    // Lookups are made with a key, so that the text is only copied when
+    // a new result is stored.
+    struct key_hash {
+        using is_transparent = void;
+        std::size_t operator()(const key &k) const { return k.hash; }
+        std::size_t operator()(const stored_key &k) const { return k.hash; }
+    };
+
+    struct key_equal {
+        using is_transparent = void;
+        bool operator()(const stored_key &a, const stored_key &b) const { return a.hash == b.hash && a.text == b.text; }
+        bool operator()(const key &a, const stored_key &b) const { return a.hash == b.hash && a.text == b.text; }
+        bool operator()(const stored_key &a, const key &b) const { return a.hash == b.hash && a.text == b.text; }
+    };
+
+    struct value {
+        std::shared_ptr<const text_result> result;
+        std::vector<std::string> files;
+    };
+
+    struct shard {
+        mutable std::mutex mutex;
+        std::unordered_map<stored_key, value, key_hash, key_equal> entries;
+    };
+
+    static constexpr std::size_t shard_count = 64;
+
+    shard &shard_for(const key &k) { return shards[k.hash % shard_count]; }
+    const shard &shard_for(const key &k) const { return shards[k.hash % shard_count]; }
+
+    const std::size_t limit;
+    const bool grouping;
+    std::array<shard, shard_count> shards;
+    std::atomic<std::size_t> stored{0};
+    mutable std::atomic<std::size_t> hit_count{0};
+};
+
+#endif
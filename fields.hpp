@@ -0,0 +1,109 @@
+/*-
+ * Copyright (c) 2023 Chris Spiegel
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef OPENMPT_CHARSET_FIELDS_HPP
+#define OPENMPT_CHARSET_FIELDS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "lines.hpp"
+
+// One line of text from a module, such as a sample name or a line of the
+// song message, along with where it came from.
+struct text_field {
+    // For fields there is only one of, such as the title.
+    static constexpr std::uint32_t no_index = UINT32_MAX;
+
+    std::string_view label;
+    std::uint32_t index;
+};
+
+// All of a module's text gathered into one buffer, one field per line, so
+// that it can be scanned and converted in one go. Because conversion
+// keeps newlines, line n of the converted buffer is always field n.
+// Clearing keeps the buffer's memory for the next module.
+class field_arena {
+public:
+    void clear()
+    {
+        buffer.clear();
+        entries.clear();
+    }
+
+    bool empty() const { return entries.empty(); }
+
+    std::string_view text() const { return buffer; }
+    std::span<const text_field> fields() const { return entries; }
+
+    // Adds text as a single field, unless it's empty. Any line breaks in
+    // it become spaces, so that it can't turn into more than one line.
+    void add(std::string_view label, std::uint32_t index, std::string_view text)
+    {
+        if (text.empty()) {
+            return;
+        }
+
+        auto start = buffer.size();
+        buffer += text;
+        for (auto i = start; i < buffer.size(); i++) {
+            if (buffer[i] == '\n' || buffer[i] == '\r') {
+                buffer[i] = ' ';
+            }
+        }
+        buffer += '\n';
+
+        entries.push_back({label, index});
+    }
+
+    // Adds each line of text as a field of its own, numbered from 1.
+    void add_lines(std::string_view label, std::string_view text)
+    {
+        line_splitter lines(text);
+        std::uint32_t n = 0;
+
+        while (!lines.done()) {
+            auto line = lines.next();
+            n++;
+
+            // Blank lines can never differ, but still count towards
+            // the numbering of the rest.
+            if (!line.empty()) {
+                add(label, n, line);
+            }
+        }
+    }
+
+private:
+    std::string buffer;
+    std::vector<text_field> entries;
+};
+
+#endif
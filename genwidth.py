@@ -0,0 +1,78 @@
+#!/usr/bin/env python3
+#
+# Generates width_table.hpp, the display widths used by width.hpp, from
+# the Unicode database of the Python running it:
+#
+#   python3 genwidth.py > width_table.hpp
+
+import sys
+import unicodedata
+
+BLOCK = 256
+
+
+def width(c):
+    ch = chr(c)
+    category = unicodedata.category(ch)
+
+    # Controls, combining marks and format characters take no columns;
+    # the soft hyphen is the exception, since terminals draw it.
+    if category in ('Cc', 'Mn', 'Me') or (category == 'Cf' and c != 0x00AD):
+        return 0
+
+    # Hangul medial vowels and final consonants join onto the syllable
+    # before them.
+    if 0x1160 <= c <= 0x11FF or 0xD7B0 <= c <= 0xD7FF:
+        return 0
+
+    if c == 0x200B:
+        return 0
+
+    if unicodedata.east_asian_width(ch) in ('W', 'F'):
+        return 2
+
+    # Unassigned codepoints in the CJK planes are wide by default.
+    if 0x20000 <= c <= 0x2FFFD or 0x30000 <= c <= 0x3FFFD:
+        return 2
+
+    return 1
+
+
+def main():
+    blocks = []
+    index = []
+    seen = {}
+
+    for start in range(0, 0x110000, BLOCK):
+        packed = bytearray(BLOCK // 4)
+        for i in range(BLOCK):
+            packed[i // 4] |= width(start + i) << ((i % 4) * 2)
+        packed = bytes(packed)
+
+        if packed not in seen:
+            seen[packed] = len(blocks)
+            blocks.append(packed)
+        index.append(seen[packed])
+
+    assert len(blocks) <= 256
+
+    out = sys.stdout
+    out.write('// Generated by genwidth.py from Unicode %s; do not edit.\n\n' % unicodedata.unidata_version)
+    out.write('#ifndef OPENMPT_CHARSET_WIDTH_TABLE_HPP\n#define OPENMPT_CHARSET_WIDTH_TABLE_HPP\n\n')
+    out.write('#include <array>\n#include <cstdint>\n\n')
+    out.write('// Which block of width_blocks holds each run of %d codepoints.\n' % BLOCK)
+    out.write('inline constexpr std::array<std::uint8_t, %d> width_index = {{\n' % len(index))
+    for i in range(0, len(index), 16):
+        out.write('    ' + ' '.join('%d,' % n for n in index[i:i + 16]) + '\n')
+    out.write('}};\n\n')
+    out.write('// Widths of %d codepoints each, at two bits a codepoint, lowest first.\n' % BLOCK)
+    out.write('inline constexpr std::array<std::array<std::uint8_t, %d>, %d> width_blocks = {{\n' % (BLOCK // 4, len(blocks)))
+    for block in blocks:
+        out.write('    {{\n')
+        for i in range(0, len(block), 16):
+            out.write('        ' + ' '.join('0x%02x,' % b for b in block[i:i + 16]) + '\n')
+        out.write('    }},\n')
+    out.write('}};\n\n#endif\n')
+
+
+main()
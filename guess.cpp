@@ -0,0 +1,228 @@
+/*-
+ * Copyright (c) 2023 Chris Spiegel
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <cmath>
+#include <vector>
+
+#include "guess.hpp"
+#include "utf8.hpp"
+
+static bool is_ascii_letter(std::uint32_t c)
+{
+    return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z');
+}
+
+static void count_neighbours(byte_histogram &histogram, std::uint32_t c, bool letter_before, bool letter_after)
+{
+    if (letter_before && letter_after) {
+        histogram.inside_words[c]++;
+    } else if (letter_before || letter_after) {
+        histogram.word_edges[c]++;
+    }
+}
+
+// ASCII runs shorter than this are counted straight into the histogram;
+// splitting them up only pays once there are enough increments to
+// overlap.
+static constexpr std::size_t split_run_length = 64;
+
+void count_bytes(std::string_view message, byte_histogram &histogram)
+{
+    auto p = reinterpret_cast<const unsigned char *>(message.data());
+    auto end = p + message.size();
+    std::uint32_t previous = 0;
+
+    // Long runs of ASCII are counted into four tables in turn, which keeps
+    // consecutive increments of the same byte from waiting on each other.
+    // The tables are only added into the histogram once, at the end.
+    std::array<std::array<std::uint32_t, 128>, 4> partial{};
+    bool split = false;
+
+    while (p != end) {
+        // Runs of ASCII are the bulk of any message.
+        std::size_t n = ascii_length(reinterpret_cast<const char *>(p), end - p);
+        if (n != 0) {
+            std::size_t i = 0;
+
+            if (n >= split_run_length) {
+                for (; i + 4 <= n; i += 4) {
+                    partial[0][p[i]]++;
+                    partial[1][p[i + 1]]++;
+                    partial[2][p[i + 2]]++;
+                    partial[3][p[i + 3]]++;
+                }
+                split = true;
+            }
+            for (; i < n; i++) {
+                histogram.counts[p[i]]++;
+            }
+
+            // Control characters are as telling as non-ASCII ones, and
+            // rare enough that going back over the run for them is cheap.
+            for (i = 0; i < n; i++) {
+                std::uint32_t c = p[i];
+                if (c < 0x20 && c != '\n') {
+                    if (i > 0 && p[i - 1] == c) {
+                        histogram.repeats[c]++;
+                    }
+                    count_neighbours(histogram, c, i > 0 && is_ascii_letter(p[i - 1]), i + 1 < n && is_ascii_letter(p[i + 1]));
+                }
+            }
+
+            previous = p[n - 1];
+            p += n;
+            continue;
+        }
+
+        std::uint32_t c = utf8_decode(p, end);
+        if (c >= 256) {
+            histogram.others++;
+            previous = c;
+            continue;
+        }
+
+        histogram.counts[c]++;
+        if (previous == c) {
+            histogram.repeats[c]++;
+        }
+        count_neighbours(histogram, c, is_ascii_letter(previous), p != end && is_ascii_letter(*p));
+        previous = c;
+    }
+
+    if (split) {
+        for (std::size_t c = 0; c < 128; c++) {
+            histogram.counts[c] += partial[0][c] + partial[1][c] + partial[2][c] + partial[3][c];
+        }
+    }
+}
+
+namespace {
+enum class glyph_class {
+    ascii,
+    box,
+    letter,
+    punctuation,
+    symbol,
+    control,
+};
+
+glyph_class classify(std::uint32_t c)
+{
+    if ((c >= 0x20 && c < 0x7F) || c == '\t' || c == '\n' || c == '\r') {
+        return glyph_class::ascii;
+    } else if (c < 0x20 || (c >= 0x7F && c < 0xA0)) {
+        return glyph_class::control;
+    } else if (c >= 0x2500 && c < 0x25A0) {
+        return glyph_class::box;
+    } else if (c >= 0x2010 && c < 0x2070) {
+        return glyph_class::punctuation;
+    } else if ((c >= 0xC0 && c < 0x250 && c != 0xD7 && c != 0xF7) || (c >= 0x370 && c < 0x400)) {
+        return glyph_class::letter;
+    } else {
+        return glyph_class::symbol;
+    }
+}
+}
+
+// Box drawing comes in runs, accented letters come inside words, and
+// typographic quotes and dashes are likely wherever they turn up;
+// invisible control characters hardly belong in a message at all. Each
+// byte adds to the score of a charset according to what it would be in
+// that charset.
+static double score(const charset &cs, const byte_histogram &histogram)
+{
+    double total = 0;
+
+    for (std::uint32_t b = 0; b < 256; b++) {
+        double n = histogram.counts[b];
+        if (n == 0) {
+            continue;
+        }
+
+        double repeats = histogram.repeats[b];
+        double inside = histogram.inside_words[b];
+        double edges = histogram.word_edges[b];
+
+        switch (classify(cs.to_unicode(b))) {
+        case glyph_class::ascii:
+            break;
+        case glyph_class::box:
+            total += n + 2 * repeats - inside - edges;
+            break;
+        case glyph_class::letter:
+            total += 0.5 * n + 1.5 * inside + 0.5 * edges - repeats;
+            break;
+        case glyph_class::punctuation:
+            total += 1.5 * n + 1.5 * inside;
+            break;
+        case glyph_class::symbol:
+            total += 0.25 * n;
+            break;
+        case glyph_class::control:
+            total -= 4 * n;
+            break;
+        }
+    }
+
+    return total;
+}
+
+std::optional<charset_guess> guess_charset(const byte_histogram &histogram)
+{
+    auto charsets = all_charsets();
+    std::vector<double> scores;
+
+    for (const auto &cs : charsets) {
+        scores.push_back(score(cs, histogram));
+    }
+
+    std::size_t best = 0;
+    for (std::size_t i = 1; i < scores.size(); i++) {
+        if (scores[i] > scores[best]) {
+            best = i;
+        }
+    }
+
+    std::size_t runner_up = best == 0 ? 1 : 0;
+    for (std::size_t i = 0; i < scores.size(); i++) {
+        if (i != best && scores[i] > scores[runner_up]) {
+            runner_up = i;
+        }
+    }
+
+    if (scores[best] == 0 && scores[runner_up] == 0) {
+        return std::nullopt;
+    }
+
+    // Scores are treated as log-likelihoods, so that a lead of a few
+    // points makes the best charset far more likely than the rest.
+    double sum = 0;
+    for (auto s : scores) {
+        sum += std::exp((s - scores[best]) / 2);
+    }
+
+    return charset_guess{&charsets[best], &charsets[runner_up], 1 / sum};
+}
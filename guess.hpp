@@ -0,0 +1,73 @@
+/*-
+ * Copyright (c) 2023 Chris Spiegel
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef OPENMPT_CHARSET_GUESS_HPP
+#define OPENMPT_CHARSET_GUESS_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+#include "charset.hpp"
+
+// What a message's original bytes look like, gathered in a single pass.
+// Bytes are codepoints below 256 in the message as libopenmpt decodes
+// it; anything above that is only counted.
+struct byte_histogram {
+    std::array<std::uint32_t, 256> counts{};
+
+    // How often each byte directly follows itself, such as a run of box
+    // drawing characters.
+    std::array<std::uint32_t, 256> repeats{};
+
+    // How often each non-ASCII or control byte has an ASCII letter on
+    // both sides, as an accented letter inside a word would, or on only
+    // one side, as at either end of a word.
+    std::array<std::uint32_t, 256> inside_words{};
+    std::array<std::uint32_t, 256> word_edges{};
+
+    std::size_t others = 0;
+};
+
+void count_bytes(std::string_view message, byte_histogram &histogram);
+
+struct charset_guess {
+    const charset *best;
+    const charset *runner_up;
+
+    // The share of the likelihood, from 0 to 1, which falls to the best
+    // charset. Charsets which agree on every byte in the message split it
+    // evenly.
+    double confidence;
+};
+
+// Scores every charset against the histogram. There is no guess when the
+// message has nothing which would differ between charsets.
+std::optional<charset_guess> guess_charset(const byte_histogram &histogram);
+
+#endif
@@ -0,0 +1,161 @@
+/*-
+ * Copyright (c) 2023 Chris Spiegel
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <cerrno>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "inputfile.hpp"
+
+namespace {
+class file_descriptor {
+public:
+    explicit file_descriptor(int fd) : fd(fd) {}
+    ~file_descriptor()
+    {
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+    file_descriptor(const file_descriptor &) = delete;
+    file_descriptor &operator=(const file_descriptor &) = delete;
+    operator int() const { return fd; }
+
+    int release()
+    {
+        int released = fd;
+        fd = -1;
+        return released;
+    }
+
+private:
+    int fd;
+};
+}
+
+input_file::input_file(const std::string &filename, bool sequential, bool any_type)
+{
+    int raw_fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+    if (raw_fd == -1) {
+        throw std::system_error(errno, std::generic_category());
+    }
+
+    // Closed again if anything below throws.
+    file_descriptor fd(raw_fd);
+    struct stat st;
+
+    if (fstat(fd, &st) == -1) {
+        throw std::system_error(errno, std::generic_category());
+    }
+
+    if (S_ISDIR(st.st_mode)) {
+        throw std::system_error(EISDIR, std::generic_category());
+    }
+
+    if (!S_ISREG(st.st_mode)) {
+        if (!any_type) {
+            throw std::system_error(EINVAL, std::generic_category(), "not a regular file");
+        }
+
+        // Opened again, blocking this time, so that a FIFO the user named
+        // waits for its writer, as it would for any other reader.
+        file_descriptor blocking_fd(open(filename.c_str(), O_RDONLY | O_CLOEXEC));
+        if (blocking_fd == -1) {
+            throw std::system_error(errno, std::generic_category());
+        }
+
+        read_all(blocking_fd);
+        this->fd = blocking_fd.release();
+        return;
+    }
+
+    is_regular = true;
+    mtime_ns = std::int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+
+    if (st.st_size > 0) {
+        void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            map = p;
+            map_size = st.st_size;
+
+            if (sequential) {
+                madvise(map, map_size, MADV_SEQUENTIAL);
+                madvise(map, map_size, MADV_WILLNEED);
+            }
+
+            this->fd = fd.release();
+            return;
+        }
+    }
+
+    read_all(fd);
+    this->fd = fd.release();
+}
+
+input_file::~input_file()
+{
+    if (map != nullptr) {
+        munmap(map, map_size);
+    }
+
+    if (fd != -1) {
+        close(fd);
+    }
+}
+
+void input_file::read_all(int fd)
+{
+    std::size_t used = 0;
+
+    buffer.resize(65536);
+
+    for (;;) {
+        if (used == buffer.size()) {
+            buffer.resize(buffer.size() * 2);
+        }
+
+        ssize_t n = read(fd, buffer.data() + used, buffer.size() - used);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            throw std::system_error(errno, std::generic_category());
+        }
+
+        if (n == 0) {
+            break;
+        }
+
+        used += n;
+    }
+
+    buffer.resize(used);
+}
@@ -0,0 +1,87 @@
+/*-
+ * Copyright (c) 2023 Chris Spiegel
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef OPENMPT_CHARSET_INPUTFILE_HPP
+#define OPENMPT_CHARSET_INPUTFILE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// The contents of a file, for handing to libopenmpt as a single block of
+// memory. Regular files are memory-mapped; anything which can't be mapped
+// (pipes, character devices, empty files, file systems which refuse
+// mmap()) is read into a buffer instead.
+//
+// Errors are reported by throwing std::system_error.
+class input_file {
+public:
+    // If sequential is true, the whole file is expected to be read, and
+    // the kernel is asked to start reading it in right away. Otherwise
+    // the default page-in behavior is kept, which is better when only a
+    // few headers are going to be looked at.
+    //
+    // Unless any_type is true, anything but a regular file is refused
+    // (with EINVAL), rather than risk waiting forever on a FIFO or reading
+    // a device without end. The file is opened without blocking either
+    // way, so even refusing a FIFO can't hang.
+    input_file(const std::string &filename, bool sequential, bool any_type = false);
+
+    // A regular file which has already been read.
+    input_file(std::vector<char> contents, std::int64_t mtime) : buffer(std::move(contents)), is_regular(true), mtime_ns(mtime) {}
+    ~input_file();
+
+    input_file(const input_file &) = delete;
+    input_file &operator=(const input_file &) = delete;
+
+    const void *data() const { return map != nullptr ? map : buffer.data(); }
+    std::size_t size() const { return map != nullptr ? map_size : buffer.size(); }
+
+    // Whether the contents are mapped rather than read in, and so can be
+    // read again with pread() on the descriptor, which stays open for as
+    // long as the input_file exists.
+    bool mapped() const { return map != nullptr; }
+    int descriptor() const { return fd; }
+
+    // Whether this is a regular file, and so has a meaningful modification
+    // time, in nanoseconds since the epoch.
+    bool regular() const { return is_regular; }
+    std::int64_t mtime() const { return mtime_ns; }
+
+private:
+    void read_all(int fd);
+
+    int fd = -1;
+    void *map = nullptr;
+    std::size_t map_size = 0;
+    std::vector<char> buffer;
+    bool is_regular = false;
+    std::int64_t mtime_ns = 0;
+};
+
+#endif
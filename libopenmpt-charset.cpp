@@ -0,0 +1,142 @@
+/*-
+ * Copyright (c) 2023 Chris Spiegel
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "charset.hpp"
+#include "libopenmpt-charset.hpp"
+
+namespace openmpt_charset {
+
+static std::string_view as_string(std::span<const char8_t> s)
+{
+    return {reinterpret_cast<const char *>(s.data()), s.size()};
+}
+
+static std::u8string_view as_message(std::string_view s)
+{
+    return {reinterpret_cast<const char8_t *>(s.data()), s.size()};
+}
+
+std::vector<std::string_view> charset_names()
+{
+    std::vector<std::string_view> names;
+
+    for (const auto &cs : all_charsets()) {
+        names.push_back(cs.name);
+    }
+
+    return names;
+}
+
+converter::converter(std::string_view name) : cs(find_charset(name))
+{
+    if (cs == nullptr) {
+        throw std::invalid_argument("unknown charset: " + std::string(name));
+    }
+}
+
+std::string_view converter::name() const
+{
+    return cs->name;
+}
+
+char32_t converter::to_unicode(std::uint8_t byte) const
+{
+    return cs->to_unicode(byte);
+}
+
+bool converter::needs_conversion(std::span<const char8_t> message) const
+{
+    return cs->needs_remap(as_string(message));
+}
+
+std::size_t converter::convert(std::span<const char8_t> message, std::span<char8_t> out) const
+{
+    if (out.size() < max_converted_size(message.size())) {
+        throw std::length_error("conversion buffer too small");
+    }
+
+    return cs->convert_into(as_string(message), reinterpret_cast<char *>(out.data()));
+}
+
+void converter::convert(std::span<const char8_t> message, std::u8string &out) const
+{
+    out.resize(max_converted_size(message.size()));
+    out.resize(convert(message, std::span<char8_t>(out)));
+}
+
+std::span<const check_result> batch::check(std::span<const std::span<const char8_t>> messages)
+{
+    results.clear();
+    lines.clear();
+    line_ends.clear();
+    line_counts.clear();
+    converted.clear();
+
+    // Changed lines are added onto the end of the shared buffer. Views into
+    // the buffer (and into lines) can only be made once it has stopped
+    // growing, so for now each result just records how many lines it has.
+    for (auto message : messages) {
+        auto text = as_string(message);
+        auto first = lines.size();
+
+        if (text.empty()) {
+            results.push_back({outcome::no_message, {}});
+            line_counts.push_back(0);
+            continue;
+        }
+
+        if (conv.needs_conversion(message)) {
+            for_each_changed_line(*conv.cs, text, new_line, [this](std::uint32_t index, std::size_t, std::string_view line, std::string_view changed) {
+                converted.append(reinterpret_cast<const char8_t *>(changed.data()), changed.size());
+                lines.push_back({index + 1, as_message(line), {}});
+                line_ends.push_back(converted.size());
+            });
+        }
+
+        results.push_back({lines.size() > first ? outcome::difference : outcome::no_difference, {}});
+        line_counts.push_back(lines.size() - first);
+    }
+
+    std::size_t start = 0;
+    for (std::size_t i = 0; i < lines.size(); i++) {
+        lines[i].converted = std::u8string_view(converted).substr(start, line_ends[i] - start);
+        start = line_ends[i];
+    }
+
+    std::size_t first = 0;
+    for (std::size_t i = 0; i < results.size(); i++) {
+        results[i].lines = std::span<const line_difference>(lines).subspan(first, line_counts[i]);
+        first += line_counts[i];
+    }
+
+    return results;
+}
+
+}
@@ -0,0 +1,128 @@
+/*-
+ * Copyright (c) 2023 Chris Spiegel
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef LIBOPENMPT_CHARSET_HPP
+#define LIBOPENMPT_CHARSET_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct charset;
+
+// The conversion and checking behind openmpt-charset, for use in-process.
+//
+// Messages are UTF-8, as libopenmpt's "message_raw" metadata gives them:
+// each byte of the message in the module as the codepoint of the same
+// value. Conversion reinterprets those codepoints as characters of a
+// legacy codepage (CP437 unless told otherwise), giving UTF-8 again.
+namespace openmpt_charset {
+
+// Names of the charsets a converter can be created for.
+std::vector<std::string_view> charset_names();
+
+// Cheap to copy; all the tables are static.
+class converter {
+public:
+    // A converter for the named charset, or one of its aliases (such as
+    // "latin1"), ignoring case. Throws std::invalid_argument if there is
+    // no such charset.
+    explicit converter(std::string_view name = "cp437");
+
+    std::string_view name() const;
+
+    // The Unicode codepoint for a byte of the charset.
+    char32_t to_unicode(std::uint8_t byte) const;
+
+    // Whether convert() could change the message. A false result is
+    // definite; after a true one the message can still come out the same.
+    bool needs_conversion(std::span<const char8_t> message) const;
+
+    // Writes the conversion of message straight to out, which must have
+    // room for max_converted_size(message.size()) bytes, and returns the
+    // number of bytes written.
+    std::size_t convert(std::span<const char8_t> message, std::span<char8_t> out) const;
+
+    // The same, replacing the contents of out.
+    void convert(std::span<const char8_t> message, std::u8string &out) const;
+
+    static constexpr std::size_t max_converted_size(std::size_t size) { return size * 3; }
+
+private:
+    friend class batch;
+
+    const ::charset *cs;
+};
+
+// What checking a message came to.
+enum class outcome : std::uint8_t {
+    no_message,
+    no_difference,
+    difference,
+};
+
+// A line of a message which conversion changes.
+struct line_difference {
+    // Numbered from 1.
+    std::uint32_t line;
+    std::u8string_view original;
+    std::u8string_view converted;
+};
+
+struct check_result {
+    openmpt_charset::outcome outcome;
+    std::span<const line_difference> lines;
+};
+
+// Checks messages the way openmpt-charset does, many at a time. Only lines
+// which could change are converted, and the converted text of every
+// message goes into one buffer owned by the batch, which is reused by the
+// next call along with the rest of its storage.
+class batch {
+public:
+    explicit batch(converter conv = converter()) : conv(conv) {}
+
+    // One result for each message, in the same order. The results are
+    // valid until the next call to check(); their original lines point
+    // into the messages themselves.
+    std::span<const check_result> check(std::span<const std::span<const char8_t>> messages);
+
+private:
+    converter conv;
+    std::vector<check_result> results;
+    std::vector<line_difference> lines;
+    std::vector<std::size_t> line_ends;
+    std::vector<std::size_t> line_counts;
+    std::u8string converted;
+    std::string new_line;
+};
+
+}
+
+#endif
@@ -0,0 +1,109 @@
+/*-
+ * Copyright (c) 2023 Chris Spiegel
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef OPENMPT_CHARSET_LINES_HPP
+#define OPENMPT_CHARSET_LINES_HPP
+
+#include <cstddef>
+#include <iterator>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+
+// Lazily splits text into lines, as views into the original buffer. Lines
+// are split the same way std::getline() splits them: a final newline
+// does not start another, empty, line, and empty text has no lines at
+// all.
+class line_splitter {
+public:
+    explicit line_splitter(std::string_view text) : rest(text) {}
+
+    bool done() const { return rest.empty(); }
+
+    // Must not be called once done() is true.
+    std::string_view next()
+    {
+        auto newline = rest.find('\n');
+        auto line = rest.substr(0, newline);
+
+        rest.remove_prefix(newline == std::string_view::npos ? rest.size() : newline + 1);
+
+        return line;
+    }
+
+private:
+    std::string_view rest;
+};
+
+// Walks the lines of two texts side by side, yielding a pair of lines at a
+// time. The texts are expected to have the same number of lines; if one
+// runs out before the other, std::runtime_error is thrown.
+class line_pairs {
+public:
+    struct sentinel {};
+
+    class iterator {
+    public:
+        using value_type = std::pair<std::string_view, std::string_view>;
+        using difference_type = std::ptrdiff_t;
+
+        iterator(std::string_view a, std::string_view b) : a(a), b(b) { advance(); }
+
+        const value_type &operator*() const { return current; }
+        iterator &operator++() { advance(); return *this; }
+        void operator++(int) { advance(); }
+        bool operator==(sentinel) const { return finished; }
+
+    private:
+        void advance()
+        {
+            if (a.done() != b.done()) {
+                throw std::runtime_error("internal error: size mismatch");
+            }
+
+            finished = a.done();
+            if (!finished) {
+                current = {a.next(), b.next()};
+            }
+        }
+
+        line_splitter a;
+        line_splitter b;
+        value_type current;
+        bool finished = false;
+    };
+
+    line_pairs(std::string_view a, std::string_view b) : a(a), b(b) {}
+
+    iterator begin() const { return {a, b}; }
+    sentinel end() const { return {}; }
+
+private:
+    std::string_view a;
+    std::string_view b;
+};
+
+#endif
@@ -0,0 +1,513 @@
+/*-
+ * Copyright (c) 2023 Chris Spiegel
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <string_view>
+
+#include "inputfile.hpp"
+#include "merge.hpp"
+#include "output.hpp"
+#include "report.hpp"
+#include "utf8.hpp"
+
+namespace {
+[[noreturn]] void malformed(const std::string &path)
+{
+    throw std::runtime_error(path + ": not a JSONL or binary report");
+}
+
+// Just enough JSON for the records report_writer and write_stats() make:
+// objects, arrays, strings and unsigned integers, with anything else
+// skipped over.
+class json_reader {
+public:
+    json_reader(std::string_view text, const std::string &path) : text(text), path(path) {}
+
+    bool accept(char c)
+    {
+        space();
+        if (pos < text.size() && text[pos] == c) {
+            pos++;
+            return true;
+        }
+
+        return false;
+    }
+
+    void expect(char c)
+    {
+        if (!accept(c)) {
+            malformed(path);
+        }
+    }
+
+    bool at_end()
+    {
+        space();
+        return pos == text.size();
+    }
+
+    // Calls member(key) with the reader positioned at each member's value,
+    // which member must read.
+    template <typename F>
+    void object(F &&member)
+    {
+        expect('{');
+        if (accept('}')) {
+            return;
+        }
+
+        do {
+            auto key = string();
+            expect(':');
+            member(key);
+        } while (accept(','));
+        expect('}');
+    }
+
+    template <typename F>
+    void array(F &&element)
+    {
+        expect('[');
+        if (accept(']')) {
+            return;
+        }
+
+        do {
+            element();
+        } while (accept(','));
+        expect(']');
+    }
+
+    std::string string()
+    {
+        std::string s;
+
+        expect('"');
+        while (pos < text.size() && text[pos] != '"') {
+            char c = text[pos++];
+            if (c != '\\') {
+                s += c;
+                continue;
+            }
+
+            if (pos == text.size()) {
+                malformed(path);
+            }
+
+            switch (c = text[pos++]) {
+            case 'b': s += '\b'; break;
+            case 'f': s += '\f'; break;
+            case 'n': s += '\n'; break;
+            case 'r': s += '\r'; break;
+            case 't': s += '\t'; break;
+            case 'u': {
+                std::uint32_t u = hex4();
+                if (u >= 0xd800 && u < 0xdc00 && text.substr(pos, 2) == "\\u") {
+                    pos += 2;
+                    std::uint32_t low = hex4();
+                    u = low >= 0xdc00 && low < 0xe000 ? 0x10000 + ((u - 0xd800) << 10) + (low - 0xdc00) : utf8_replacement;
+                }
+                char encoded[4];
+                s.append(encoded, utf8_encode(u, encoded));
+                break;
+            }
+            default:
+                s += c;
+                break;
+            }
+        }
+        expect('"');
+
+        return s;
+    }
+
+    std::uint64_t number()
+    {
+        space();
+
+        std::uint64_t n = 0;
+        auto start = pos;
+        while (pos < text.size() && text[pos] >= '0' && text[pos] <= '9') {
+            n = n * 10 + (text[pos++] - '0');
+        }
+
+        if (pos == start) {
+            malformed(path);
+        }
+
+        return n;
+    }
+
+    void skip()
+    {
+        space();
+        if (pos == text.size()) {
+            malformed(path);
+        }
+
+        switch (text[pos]) {
+        case '{':
+            object([this](const std::string &) { skip(); });
+            break;
+        case '[':
+            array([this] { skip(); });
+            break;
+        case '"':
+            string();
+            break;
+        default:
+            // Numbers and literals.
+            while (pos < text.size() && std::string_view(",]} \t\r\n").find(text[pos]) == std::string_view::npos) {
+                pos++;
+            }
+            break;
+        }
+    }
+
+private:
+    void space()
+    {
+        while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\r' || text[pos] == '\n')) {
+            pos++;
+        }
+    }
+
+    std::uint32_t hex4()
+    {
+        std::uint32_t u = 0;
+
+        for (int i = 0; i < 4; i++) {
+            if (pos == text.size()) {
+                malformed(path);
+            }
+
+            char c = text[pos++];
+            u <<= 4;
+            if (c >= '0' && c <= '9') {
+                u |= c - '0';
+            } else if (c >= 'a' && c <= 'f') {
+                u |= c - 'a' + 10;
+            } else if (c >= 'A' && c <= 'F') {
+                u |= c - 'A' + 10;
+            } else {
+                malformed(path);
+            }
+        }
+
+        return u;
+    }
+
+    std::string_view text;
+    const std::string &path;
+    std::size_t pos = 0;
+};
+
+// Little-endian integers and length-prefixed strings, as written by
+// report.cpp.
+class binary_reader {
+public:
+    binary_reader(std::string_view body, const std::string &path) : body(body), path(path) {}
+
+    bool at_end() const { return body.empty(); }
+
+    std::string_view bytes(std::size_t n)
+    {
+        if (n > body.size()) {
+            malformed(path);
+        }
+
+        auto s = body.substr(0, n);
+        body.remove_prefix(n);
+        return s;
+    }
+
+    std::uint64_t integer(std::size_t size)
+    {
+        std::uint64_t n = 0;
+        auto s = bytes(size);
+
+        for (std::size_t i = 0; i < size; i++) {
+            n |= std::uint64_t(static_cast<unsigned char>(s[i])) << (i * 8);
+        }
+
+        return n;
+    }
+
+    std::uint8_t u8() { return integer(1); }
+    std::uint32_t u32() { return integer(4); }
+    std::uint64_t u64() { return integer(8); }
+    std::string_view string() { return bytes(u32()); }
+
+private:
+    std::string_view body;
+    const std::string &path;
+};
+
+latency_histogram *find_histogram(stats_snapshot &stats, std::string_view name, const std::string &path)
+{
+    if (name == "file") {
+        return &stats.files;
+    }
+
+    for (std::size_t i = 0; i < stage_count; i++) {
+        if (name == stage_names[i]) {
+            return &stats.stages[i];
+        }
+    }
+
+    throw std::runtime_error(path + ": unknown stage " + std::string(name));
+}
+
+void add_bucket(latency_histogram &h, std::uint64_t bucket, std::uint64_t n, const std::string &path)
+{
+    if (bucket >= h.bucket_count) {
+        malformed(path);
+    }
+
+    h.buckets[bucket] = n;
+}
+
+merged_stats read_json_stats(json_reader &json, const std::string &path)
+{
+    merged_stats result;
+
+    json.object([&](const std::string &key) {
+        if (key == "elapsed") {
+            result.elapsed_ns = json.number();
+        } else if (key == "bytes") {
+            result.stats.bytes = json.number();
+        } else if (key == "stages") {
+            json.object([&](const std::string &name) {
+                auto &h = *find_histogram(result.stats, name, path);
+                json.object([&](const std::string &field) {
+                    if (field == "count") {
+                        h.count = json.number();
+                    } else if (field == "total") {
+                        h.total = json.number();
+                    } else if (field == "max") {
+                        h.max = json.number();
+                    } else if (field == "buckets") {
+                        json.array([&] {
+                            json.expect('[');
+                            auto bucket = json.number();
+                            json.expect(',');
+                            add_bucket(h, bucket, json.number(), path);
+                            json.expect(']');
+                        });
+                    } else {
+                        json.skip();
+                    }
+                });
+            });
+        } else if (key == "slowest") {
+            json.array([&] {
+                json.expect('[');
+                auto ns = json.number();
+                json.expect(',');
+                result.stats.slowest.emplace_back(ns, json.string());
+                json.expect(']');
+            });
+        } else {
+            json.skip();
+        }
+    });
+
+    return result;
+}
+
+merged_stats read_binary_stats(binary_reader &binary, const std::string &path)
+{
+    merged_stats result;
+
+    result.elapsed_ns = binary.u64();
+    result.stats.bytes = binary.u64();
+
+    for (auto n = binary.u32(); n > 0; n--) {
+        auto &h = *find_histogram(result.stats, binary.string(), path);
+        h.count = binary.u64();
+        h.total = binary.u64();
+        h.max = binary.u64();
+        for (auto buckets = binary.u32(); buckets > 0; buckets--) {
+            auto bucket = binary.u32();
+            add_bucket(h, bucket, binary.u64(), path);
+        }
+    }
+
+    for (auto n = binary.u32(); n > 0; n--) {
+        auto ns = binary.u64();
+        result.stats.slowest.emplace_back(ns, binary.string());
+    }
+
+    return result;
+}
+
+struct record {
+    std::string file;
+    std::string_view text;
+};
+
+class report_merger {
+public:
+    void add(const std::string &path)
+    {
+        inputs.push_back(std::make_unique<input_file>(path, true));
+        std::string_view text(static_cast<const char *>(inputs.back()->data()), inputs.back()->size());
+
+        if (text.empty()) {
+            return;
+        }
+
+        report_format format;
+        if (text.starts_with("{\"file\":") || text.starts_with("{\"stats\":")) {
+            format = report_format::jsonl;
+        } else if (text.size() >= 5 && (text[4] == 1 || text[4] == 2)) {
+            format = report_format::binary;
+        } else {
+            malformed(path);
+        }
+
+        if (this->format && *this->format != format) {
+            throw std::runtime_error(path + ": not in the same format as the other reports");
+        }
+        this->format = format;
+
+        if (format == report_format::jsonl) {
+            add_jsonl(text, path);
+        } else {
+            add_binary(text, path);
+        }
+    }
+
+    std::optional<merged_stats> write(std::ostream &os)
+    {
+        std::stable_sort(records.begin(), records.end(), [](const record &a, const record &b) { return a.file < b.file; });
+
+        for (const auto &r : records) {
+            os.write(r.text.data(), r.text.size());
+        }
+
+        if (stats) {
+            output_buffer out;
+            write_stats(out, *format, stats->stats, stats->elapsed_ns);
+            os.write(out.view().data(), out.size());
+        }
+
+        os.flush();
+        return stats;
+    }
+
+private:
+    void add_stats(const merged_stats &run)
+    {
+        if (!stats) {
+            stats.emplace();
+        }
+
+        stats->stats.merge(run.stats);
+        stats->elapsed_ns = std::max(stats->elapsed_ns, run.elapsed_ns);
+    }
+
+    void add_jsonl(std::string_view text, const std::string &path)
+    {
+        while (!text.empty()) {
+            auto newline = text.find('\n');
+            auto line = text.substr(0, newline == std::string_view::npos ? text.size() : newline + 1);
+            text.remove_prefix(line.size());
+
+            json_reader json(line, path);
+            if (json.at_end()) {
+                continue;
+            }
+
+            std::optional<std::string> file;
+            json.object([&](const std::string &key) {
+                if (key == "file" && !file) {
+                    file = json.string();
+                } else if (key == "stats") {
+                    add_stats(read_json_stats(json, path));
+                } else {
+                    json.skip();
+                }
+            });
+
+            if (!json.at_end()) {
+                malformed(path);
+            }
+
+            if (file) {
+                // Lines are copied with their newline, which the last
+                // line of a truncated report might not have.
+                if (line.back() != '\n') {
+                    malformed(path);
+                }
+                records.push_back({std::move(*file), line});
+            }
+        }
+    }
+
+    void add_binary(std::string_view text, const std::string &path)
+    {
+        binary_reader reports(text, path);
+
+        while (!reports.at_end()) {
+            auto length = reports.u32();
+            auto body = reports.bytes(length);
+            binary_reader binary(body, path);
+
+            switch (binary.u8()) {
+            case 1:
+                binary.u8();
+                records.push_back({std::string(binary.string()), std::string_view(body.data() - 4, body.size() + 4)});
+                break;
+            case 2:
+                add_stats(read_binary_stats(binary, path));
+                break;
+            default:
+                malformed(path);
+            }
+        }
+    }
+
+    std::vector<std::unique_ptr<input_file>> inputs;
+    std::optional<report_format> format;
+    std::vector<record> records;
+    std::optional<merged_stats> stats;
+};
+}
+
+std::optional<merged_stats> merge_reports(const std::vector<std::string> &paths, std::ostream &os)
+{
+    report_merger merger;
+
+    for (const auto &path : paths) {
+        merger.add(path);
+    }
+
+    return merger.write(os);
+}
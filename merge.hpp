@@ -0,0 +1,60 @@
+/*-
+ * Copyright (c) 2023 Chris Spiegel
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef OPENMPT_CHARSET_MERGE_HPP
+#define OPENMPT_CHARSET_MERGE_HPP
+
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "stats.hpp"
+
+// The stats records of the merged reports, added up. Elapsed time is the
+// longest of any of them, since the runs are taken to have been side by
+// side.
+struct merged_stats {
+    stats_snapshot stats;
+    std::uint64_t elapsed_ns = 0;
+};
+
+// For --merge: combines the JSONL or binary reports of several runs, such
+// as the shards of a --shard scan, into one report in the same format.
+// Every file's record is copied through unchanged, sorted by filename
+// (records for the same name keep the order they were given in); a
+// single stats record follows if any of the runs had one.
+//
+// All of the reports are read into memory (mapped where possible) before
+// anything is written, since each run's records are in the order it
+// found the files, not sorted.
+//
+// Throws std::system_error if a report can't be read, and
+// std::runtime_error if it isn't a report or the formats differ.
+std::optional<merged_stats> merge_reports(const std::vector<std::string> &paths, std::ostream &os);
+
+#endif
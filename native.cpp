@@ -0,0 +1,286 @@
+/*-
+ * Copyright (c) 2023 Chris Spiegel
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+#include "native.hpp"
+
+namespace {
+// A bounds-checked view of the file.
+class file_view {
+public:
+    file_view(const void *data, std::size_t size) : data(static_cast<const unsigned char *>(data)), length(size) {}
+
+    std::size_t size() const { return length; }
+
+    bool has(std::size_t offset, std::size_t n) const
+    {
+        return offset <= length && n <= length - offset;
+    }
+
+    bool magic(std::size_t offset, std::string_view s) const
+    {
+        return has(offset, s.size()) && std::memcmp(data + offset, s.data(), s.size()) == 0;
+    }
+
+    std::uint8_t u8(std::size_t offset) const { return data[offset]; }
+
+    std::uint16_t le16(std::size_t offset) const
+    {
+        return data[offset] | data[offset + 1] << 8;
+    }
+
+    std::uint32_t le32(std::size_t offset) const
+    {
+        return le16(offset) | std::uint32_t(le16(offset + 2)) << 16;
+    }
+
+    std::uint32_t be32(std::size_t offset) const
+    {
+        return std::uint32_t(data[offset]) << 24 | data[offset + 1] << 16 | data[offset + 2] << 8 | data[offset + 3];
+    }
+
+    std::string_view bytes(std::size_t offset, std::size_t n) const
+    {
+        return {reinterpret_cast<const char *>(data + offset), n};
+    }
+
+private:
+    const unsigned char *data;
+    std::size_t length;
+};
+
+enum class line_ending {
+    cr,
+    autodetect,
+};
+
+// With line_ending::cr, only a carriage return ends a line (a line feed
+// is already a newline). With autodetect, CR, LF and CR LF all do. As in
+// libopenmpt, trailing NULs are dropped and any others become spaces.
+//
+// libopenmpt decodes the rest with a charset it picks from the format and
+// the tracker which wrote the file, which only agrees with ASCII for
+// certain on printable characters and tabs. Anything else gives no
+// result, so that libopenmpt reads the message instead.
+std::optional<std::pmr::string> decode_message(std::string_view raw, line_ending ending, std::pmr::memory_resource *memory)
+{
+    std::pmr::string message(memory);
+
+    while (!raw.empty() && raw.back() == '\0') {
+        raw.remove_suffix(1);
+    }
+    message.reserve(raw.size());
+
+    for (std::size_t i = 0; i < raw.size(); i++) {
+        unsigned char c = raw[i];
+
+        if (c == '\r') {
+            if (ending == line_ending::autodetect && i + 1 < raw.size() && raw[i + 1] == '\n') {
+                i++;
+            }
+            message += '\n';
+        } else if (c == '\0') {
+            message += ' ';
+        } else if ((c >= 0x20 && c < 0x7F) || c == '\t' || c == '\n') {
+            message += char(c);
+        } else {
+            return std::nullopt;
+        }
+    }
+
+    return message;
+}
+
+std::optional<std::pmr::string> it_message(const file_view &file, std::pmr::memory_resource *memory)
+{
+    if (file.size() < 0xC0) {
+        return std::nullopt;
+    }
+
+    if ((file.le16(0x2E) & 1) == 0) {
+        return std::pmr::string(memory);
+    }
+
+    std::size_t length = file.le16(0x36);
+    std::size_t offset = file.le32(0x38);
+    if (!file.has(offset, length)) {
+        return std::nullopt;
+    }
+
+    // Impulse Tracker itself writes CR, but other trackers write CR LF
+    // or LF, so libopenmpt accepts any of them.
+    return decode_message(file.bytes(offset, length), line_ending::autodetect, memory);
+}
+
+// XM has no message of its own, but ModPlug and OpenMPT write one in a
+// "text" chunk straight after the sample data; finding that means
+// walking every pattern, instrument and sample header.
+std::optional<std::pmr::string> xm_message(const file_view &file, std::pmr::memory_resource *memory)
+{
+    if (!file.has(0, 80) || file.u8(37) != 0x1A || file.le16(58) != 0x0104) {
+        return std::nullopt;
+    }
+
+    std::size_t pos = 60 + std::size_t(file.le32(60));
+    std::size_t patterns = file.le16(70);
+    std::size_t instruments = file.le16(72);
+
+    for (std::size_t i = 0; i < patterns; i++) {
+        if (!file.has(pos, 9)) {
+            return std::nullopt;
+        }
+
+        std::size_t header = file.le32(pos);
+        if (header < 9) {
+            return std::nullopt;
+        }
+
+        pos += header + file.le16(pos + 7);
+    }
+
+    for (std::size_t i = 0; i < instruments; i++) {
+        if (!file.has(pos, 29)) {
+            return std::nullopt;
+        }
+
+        std::size_t header = file.le32(pos);
+        std::size_t samples = file.le16(pos + 27);
+        if (header < 29 || (samples > 0 && (header < 33 || !file.has(pos, 33)))) {
+            return std::nullopt;
+        }
+
+        std::size_t sample_header = samples > 0 ? file.le32(pos + 29) : 0;
+        pos += header;
+
+        if (sample_header < 40 && samples > 0) {
+            return std::nullopt;
+        }
+
+        std::size_t sample_data = 0;
+        for (std::size_t j = 0; j < samples; j++, pos += sample_header) {
+            if (!file.has(pos, 40)) {
+                return std::nullopt;
+            }
+
+            // ModPlug's ADPCM samples are smaller than their length says.
+            if (file.u8(pos + 17) == 0xAD) {
+                return std::nullopt;
+            }
+
+            sample_data += file.le32(pos);
+        }
+
+        pos += sample_data;
+    }
+
+    if (!file.magic(pos, "text")) {
+        return std::pmr::string(memory);
+    }
+
+    if (!file.has(pos, 8) || !file.has(pos + 8, file.le32(pos + 4))) {
+        return std::nullopt;
+    }
+
+    return decode_message(file.bytes(pos + 8, file.le32(pos + 4)), line_ending::cr, memory);
+}
+
+// The annotation text is found through the expansion block, if there is
+// one; its length counts the terminating NUL.
+std::optional<std::pmr::string> med_message(const file_view &file, std::pmr::memory_resource *memory)
+{
+    if (!file.has(0, 52)) {
+        return std::nullopt;
+    }
+
+    std::size_t expansion = file.be32(32);
+    if (expansion == 0) {
+        return std::pmr::string(memory);
+    }
+
+    if (!file.has(expansion, 20)) {
+        return std::nullopt;
+    }
+
+    std::size_t offset = file.be32(expansion + 12);
+    std::size_t length = file.be32(expansion + 16);
+    if (offset == 0 || length <= 1) {
+        return std::pmr::string(memory);
+    }
+
+    if (!file.has(offset, length)) {
+        return std::nullopt;
+    }
+
+    return decode_message(file.bytes(offset, length - 1), line_ending::autodetect, memory);
+}
+
+bool is_s3m(const file_view &file)
+{
+    return file.has(0, 96) && file.u8(28) == 0x1A && file.u8(29) == 16 && file.magic(44, "SCRM");
+}
+
+// Only 31-sample MODs have a signature to check; the older 15-sample
+// kind is left to libopenmpt.
+bool is_mod(const file_view &file)
+{
+    static constexpr std::string_view signatures[] = {"M.K.", "M!K!", "M&K!", "FLT4", "FLT8", "CD81", "OKTA", "OCTA"};
+
+    if (!file.has(1080, 4)) {
+        return false;
+    }
+
+    auto tag = file.bytes(1080, 4);
+    if (std::find(std::begin(signatures), std::end(signatures), tag) != std::end(signatures)) {
+        return true;
+    }
+
+    auto digit = [](char c) { return c >= '0' && c <= '9'; };
+
+    // "6CHN", "16CH" and "16CN".
+    return (digit(tag[0]) && tag.substr(1) == "CHN") || (digit(tag[0]) && digit(tag[1]) && (tag.substr(2) == "CH" || tag.substr(2) == "CN"));
+}
+}
+
+std::optional<std::pmr::string> native_message(const void *data, std::size_t size, std::pmr::memory_resource *memory)
+{
+    file_view file(data, size);
+
+    if (file.magic(0, "IMPM")) {
+        return it_message(file, memory);
+    } else if (file.magic(0, "Extended Module: ")) {
+        return xm_message(file, memory);
+    } else if (file.magic(0, "MMD") && file.has(3, 1) && file.u8(3) >= '0' && file.u8(3) <= '3') {
+        return med_message(file, memory);
+    } else if (is_s3m(file) || is_mod(file)) {
+        return std::pmr::string(memory);
+    }
+
+    return std::nullopt;
+}
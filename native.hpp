@@ -0,0 +1,54 @@
+/*-
+ * Copyright (c) 2023 Chris Spiegel
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef OPENMPT_CHARSET_NATIVE_HPP
+#define OPENMPT_CHARSET_NATIVE_HPP
+
+#include <cstddef>
+#include <memory_resource>
+#include <optional>
+#include <string>
+
+// Reads the song message straight out of a module, without libopenmpt.
+// Only the header fields needed to find the message, and the message
+// itself, are looked at. Line breaks are handled as libopenmpt does for
+// each format: they become newlines, trailing NULs are dropped and any
+// other NULs become spaces. libopenmpt's "message_raw" decodes the text
+// with the charset it picks for the format and tracker (CP437 or
+// Windows-1252 for IT, Windows-1252 for XM, Amiga for MED), which isn't
+// copied here: a message with anything other than printable ASCII and
+// tabs has no result, and is left to libopenmpt. So whenever there is a
+// result, it is the same as libopenmpt's, byte for byte.
+//
+// IT (and MPTM), XM, S3M, MOD and MED/OctaMED files are understood.
+// Formats without song messages (S3M and MOD) come back empty. For
+// anything else, or for a file which doesn't look quite right, there
+// is no result, and libopenmpt should have the final say.
+//
+// The message is allocated from memory.
+std::optional<std::pmr::string> native_message(const void *data, std::size_t size, std::pmr::memory_resource *memory = std::pmr::get_default_resource());
+
+#endif
@@ -25,183 +25,1194 @@
  */
 
 #include <algorithm>
-#include <codecvt>
+#include <atomic>
+#include <chrono>
+#include <cctype>
+#include <cinttypes>
 #include <cstdint>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
-#include <iomanip>
 #include <iostream>
-#include <locale>
-#include <sstream>
-#include <stdexcept>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
 #include <vector>
 
+#include <getopt.h>
+
 #include <libopenmpt/libopenmpt.hpp>
 
+#ifdef HAVE_LIBARCHIVE
+#include "archive.hpp"
+#endif
+#include "budget.hpp"
+#include "cache.hpp"
+#include "charset.hpp"
+#include "dedup.hpp"
+#include "fields.hpp"
+#include "guess.hpp"
+#include "hash.hpp"
+#include "inputfile.hpp"
+#include "lines.hpp"
+#include "merge.hpp"
+#include "native.hpp"
+#include "output.hpp"
+#include "prefetch.hpp"
+#include "report.hpp"
+#include "scratch.hpp"
+#include "server.hpp"
+#include "stats.hpp"
+#include "streammodule.hpp"
+#include "utf8.hpp"
+#include "walk.hpp"
+#include "workpool.hpp"
+
 // If true, only display the lines of the message which differ;
 // otherwise, the entire message is shown.
 static bool diff_only = true;
 
-static std::vector<std::uint32_t> utf8_to_codepoints(const std::string &s)
+// If true, load the entire module, including sample data, patterns and
+// plugins; otherwise, tell libopenmpt to skip everything which is not
+// needed to read the song message.
+static bool full_load = false;
+
+// Initial ctls passed to libopenmpt when constructing a module; set up
+// once in main() according to full_load.
+static std::map<std::string, std::string> load_ctls;
+
+// If true, print a summary of what was done to standard error on exit.
+static bool verbose = false;
+
+// Number of files which were skipped because libopenmpt's header probe
+// did not recognize them as modules.
+static std::atomic<std::size_t> files_not_modules{0};
+
+// Number of files whose message was found not to need converting by the
+// quick scan, without running the conversion itself.
+static std::atomic<std::size_t> files_fast_path{0};
+
+// The codepage which messages are assumed to really be in.
+static const charset *message_charset = &default_charset();
+
+// If true, report which charset each message most likely is in, instead
+// of how it would look converted.
+static bool guess_mode = false;
+
+// If true, check every piece of text in a module (title, sample,
+// instrument, pattern and channel names as well as the message), instead
+// of just the message.
+static bool all_fields = false;
+
+// If true, read messages directly from the formats native_message()
+// understands, and only load the module with libopenmpt for the rest.
+// This is off unless asked for. native_message() leaves any message
+// which isn't plain ASCII to libopenmpt, whose charset rules it doesn't
+// copy; --cross-check (and "make check-native") compare the two.
+static bool use_native = false;
+
+// If true, read messages both ways, and complain about any file where
+// the two differ.
+static bool cross_check = false;
+
+// Number of files for which the native reader and libopenmpt disagreed.
+static std::atomic<std::size_t> cross_check_failures{0};
+
+// Number of files whose message was read without libopenmpt.
+static std::atomic<std::size_t> files_native{0};
+
+// Number of files loaded through a stream_module.
+static std::atomic<std::size_t> files_streamed{0};
+
+// Files larger than this are left for the workers to map, rather than
+// being read ahead by the prefetcher.
+static constexpr std::size_t prefetch_max_size = 16 * 1024 * 1024;
+
+// Mapped files at least this large are given to libopenmpt through a
+// stream_module, a window at a time, rather than as one block of memory.
+static std::uintmax_t stream_size = 16 * 1024 * 1024;
+
+// For --check and --count: only whether each file differs is worked out,
+// with nothing printed for it. With --check, checking stops at the first
+// file which differs.
+static bool check_only = false;
+static bool stop_at_difference = false;
+
+// Number of files (counting each archive as one) which differ, and which
+// couldn't be checked.
+static std::atomic<std::size_t> files_differing{0};
+static std::atomic<std::size_t> files_failed{0};
+
+// For --shard: only the files whose path hashes to shard_index, of
+// shard_count shards, are checked. Every path, whether named by the user
+// or found in a directory, is hashed as it would be printed, so every
+// shard must be given the same paths.
+static std::uint64_t shard_index = 0;
+static std::uint64_t shard_count = 1;
+
+// Number of files left for other shards.
+static std::atomic<std::size_t> files_other_shards{0};
+
+// Limit on the memory used by the files being loaded at once, if
+// --memory-budget was given.
+static std::unique_ptr<memory_budget> budget;
+
+// Results for text already seen in other files, unless --no-dedup was
+// given. Only so much is kept, unless files are being grouped.
+static std::unique_ptr<text_dedup> dedup;
+static constexpr std::size_t dedup_limit = 64 * 1024 * 1024;
+
+// If true, files whose messages differ in the same way are listed
+// together at the end, instead of each getting a report.
+static bool group_files = false;
+
+// How reports are written.
+static report_format output_format = report_format::text;
+
+// Results of earlier runs, if --cache was given.
+static std::unique_ptr<result_cache> cache;
+
+static check_outcome guess_message(report_writer &report, std::string_view message)
 {
-    std::wstring_convert<std::codecvt_utf8<char32_t>, char32_t> converter;
-    std::u32string utf32 = converter.from_bytes(s);
+    byte_histogram histogram;
 
-    return {utf32.begin(), utf32.end()};
+    timed(stage::scan, [&] { count_bytes(message, histogram); });
+
+    auto guess = guess_charset(histogram);
+    if (!guess) {
+        return check_outcome::no_difference;
+    }
+
+    report.guess(*guess);
+    return check_outcome::difference;
 }
 
-static std::string codepoints_to_utf8(const std::vector<std::uint32_t> &codepoints)
+template <typename Module>
+static void collect_fields(const Module &mod, field_arena &arena)
 {
-    std::wstring_convert<std::codecvt_utf8<char32_t>, char32_t> converter;
-    std::u32string utf32(codepoints.begin(), codepoints.end());
+    auto add_names = [&arena](std::string_view label, const std::vector<std::string> &names, std::uint32_t first) {
+        for (std::size_t i = 0; i < names.size(); i++) {
+            arena.add(label, first + i, names[i]);
+        }
+    };
 
-    return converter.to_bytes(utf32);
+    arena.add("title", text_field::no_index, mod.get_metadata("title"));
+    add_names("sample", mod.get_sample_names(), 1);
+    add_names("instrument", mod.get_instrument_names(), 1);
+    add_names("pattern", mod.get_pattern_names(), 0);
+    add_names("channel", mod.get_channel_names(), 1);
+    arena.add_lines("message", mod.get_metadata("message_raw"));
 }
 
-static std::uint32_t cp437_to_unicode(std::uint32_t c)
+// Works out which lines of text have to be reported.
+static void convert_text(std::string_view text, text_result &result)
 {
-    switch (c) {
-        case 0x00: return 0x2400; case 0x01: return 0x263A; case 0x02: return 0x263B; case 0x03: return 0x2665;
-        case 0x04: return 0x2666; case 0x05: return 0x2663; case 0x06: return 0x2660; case 0x07: return 0x2022;
-        case 0x08: return 0x25D8; case 0x09: return 0x25CB; /*case 0x0A: return 0x25D9;*/ case 0x0B: return 0x2642;
-        case 0x0C: return 0x2640; case 0x0D: return 0x266A; case 0x0E: return 0x266B; case 0x0F: return 0x263C;
-        case 0x10: return 0x25BA; case 0x11: return 0x25C4; case 0x12: return 0x2195; case 0x13: return 0x203C;
-        case 0x14: return 0x00B6; case 0x15: return 0x00A7; case 0x16: return 0x25AC; case 0x17: return 0x21A8;
-        case 0x18: return 0x2191; case 0x19: return 0x2193; case 0x1A: return 0x2192; case 0x1B: return 0x2190;
-        case 0x1C: return 0x221F; case 0x1D: return 0x2194; case 0x1E: return 0x25B2; case 0x1F: return 0x25BC;
-        case 0x7F: return 0x2302;
-        case 0x80: return 0x00C7; case 0x81: return 0x00FC; case 0x82: return 0x00E9; case 0x83: return 0x00E2;
-        case 0x84: return 0x00E4; case 0x85: return 0x00E0; case 0x86: return 0x00E5; case 0x87: return 0x00E7;
-        case 0x88: return 0x00EA; case 0x89: return 0x00EB; case 0x8A: return 0x00E8; case 0x8B: return 0x00EF;
-        case 0x8C: return 0x00EE; case 0x8D: return 0x00EC; case 0x8E: return 0x00C4; case 0x8F: return 0x00C5;
-        case 0x90: return 0x00C9; case 0x91: return 0x00E6; case 0x92: return 0x00C6; case 0x93: return 0x00F4;
-        case 0x94: return 0x00F6; case 0x95: return 0x00F2; case 0x96: return 0x00FB; case 0x97: return 0x00F9;
-        case 0x98: return 0x00FF; case 0x99: return 0x00D6; case 0x9A: return 0x00DC; case 0x9B: return 0x00A2;
-        case 0x9C: return 0x00A3; case 0x9D: return 0x00A5; case 0x9E: return 0x20A7; case 0x9F: return 0x0192;
-        case 0xA0: return 0x00E1; case 0xA1: return 0x00ED; case 0xA2: return 0x00F3; case 0xA3: return 0x00FA;
-        case 0xA4: return 0x00F1; case 0xA5: return 0x00D1; case 0xA6: return 0x00AA; case 0xA7: return 0x00BA;
-        case 0xA8: return 0x00BF; case 0xA9: return 0x2310; case 0xAA: return 0x00AC; case 0xAB: return 0x00BD;
-        case 0xAC: return 0x00BC; case 0xAD: return 0x00A1; case 0xAE: return 0x00AB; case 0xAF: return 0x00BB;
-        case 0xB0: return 0x2591; case 0xB1: return 0x2592; case 0xB2: return 0x2593; case 0xB3: return 0x2502;
-        case 0xB4: return 0x2524; case 0xB5: return 0x2561; case 0xB6: return 0x2562; case 0xB7: return 0x2556;
-        case 0xB8: return 0x2555; case 0xB9: return 0x2563; case 0xBA: return 0x2551; case 0xBB: return 0x2557;
-        case 0xBC: return 0x255D; case 0xBD: return 0x255C; case 0xBE: return 0x255B; case 0xBF: return 0x2510;
-        case 0xC0: return 0x2514; case 0xC1: return 0x2534; case 0xC2: return 0x252C; case 0xC3: return 0x251C;
-        case 0xC4: return 0x2500; case 0xC5: return 0x253C; case 0xC6: return 0x255E; case 0xC7: return 0x255F;
-        case 0xC8: return 0x255A; case 0xC9: return 0x2554; case 0xCA: return 0x2569; case 0xCB: return 0x2566;
-        case 0xCC: return 0x2560; case 0xCD: return 0x2550; case 0xCE: return 0x256C; case 0xCF: return 0x2567;
-        case 0xD0: return 0x2568; case 0xD1: return 0x2564; case 0xD2: return 0x2565; case 0xD3: return 0x2559;
-        case 0xD4: return 0x2558; case 0xD5: return 0x2552; case 0xD6: return 0x2553; case 0xD7: return 0x256B;
-        case 0xD8: return 0x256A; case 0xD9: return 0x2518; case 0xDA: return 0x250C; case 0xDB: return 0x2588;
-        case 0xDC: return 0x2584; case 0xDD: return 0x258C; case 0xDE: return 0x2590; case 0xDF: return 0x2580;
-        case 0xE0: return 0x03B1; case 0xE1: return 0x00DF; case 0xE2: return 0x0393; case 0xE3: return 0x03C0;
-        case 0xE4: return 0x03A3; case 0xE5: return 0x03C3; case 0xE6: return 0x00B5; case 0xE7: return 0x03C4;
-        case 0xE8: return 0x03A6; case 0xE9: return 0x0398; case 0xEA: return 0x03A9; case 0xEB: return 0x03B4;
-        case 0xEC: return 0x221E; case 0xED: return 0x03C6; case 0xEE: return 0x03B5; case 0xEF: return 0x2229;
-        case 0xF0: return 0x2261; case 0xF1: return 0x00B1; case 0xF2: return 0x2265; case 0xF3: return 0x2264;
-        case 0xF4: return 0x2320; case 0xF5: return 0x2321; case 0xF6: return 0x00F7; case 0xF7: return 0x2248;
-        case 0xF8: return 0x00B0; case 0xF9: return 0x2219; case 0xFA: return 0x00B7; case 0xFB: return 0x221A;
-        case 0xFC: return 0x207F; case 0xFD: return 0x00B2; case 0xFE: return 0x25A0; case 0xFF: return 0x00A0;
-    default:
-        return c;
+    result.clear();
+
+    if (!diff_only) {
+        thread_local std::string converted;
+        timed(stage::convert, [&] { message_charset->convert(text, converted); });
+
+        if (text == converted) {
+            return;
+        }
+
+        std::uint32_t index = 0;
+        for (auto [line, new_line] : line_pairs(text, converted)) {
+            result.add(index++, report_writer::unmeasured, line, new_line);
+        }
+
+        result.outcome = check_outcome::difference;
+        return;
+    }
+
+    // The line buffer is kept from one file to the next, so a long message
+    // with a few lines of box drawing costs little more than the scan.
+    thread_local std::string new_line;
+
+    timed(stage::convert, [&] {
+        for_each_changed_line(*message_charset, text, new_line, [&](std::uint32_t index, std::size_t columns, std::string_view line, std::string_view converted) {
+            result.add(index, columns, line, converted);
+        });
+    });
+
+    if (!result.empty()) {
+        result.outcome = check_outcome::difference;
     }
 }
 
-static std::vector<std::string> split(const std::string &s, char delimiter)
+// Reports the lines of text which differ, reusing the work done for any
+// earlier file with the same text. where gives the location to report
+// for each line, from its index in the text.
+template <typename Where>
+static check_outcome check_text(report_writer &report, std::string_view text, Where where)
 {
-    std::vector<std::string> tokens;
-    std::istringstream ss(s);
-    std::string token;
+    thread_local text_result own;
+    std::shared_ptr<const text_result> shared;
+    const text_result *result = &own;
+    text_dedup::key key;
 
-    while (std::getline(ss, token, delimiter)) {
-        tokens.push_back(token);
+    if (dedup != nullptr) {
+        key = timed(stage::hash, [&] { return text_dedup::key_of(text); });
+        shared = dedup->find(key);
+
+        // What's kept outlives the file, so it can't come from the scratch
+        // arena. Instead it's worked out in the thread's own result, whose
+        // buffers are kept from one file to the next, and copied once at
+        // its final size.
+        if (shared == nullptr) {
+            convert_text(text, own);
+            shared = dedup->insert(key, std::make_shared<text_result>(own));
+        }
+
+        result = shared.get();
+    } else {
+        convert_text(text, own);
+    }
+
+    // Left for the summary at the end.
+    if (group_files && result->outcome == check_outcome::difference) {
+        dedup->add_file(key, report.name());
+        return result->outcome;
+    }
+
+    stage_timer timer(stage::format);
+    for (std::size_t i = 0; i < result->size(); i++) {
+        auto line = (*result)[i];
+        report.line(where(line.index), line.original, line.converted, line.columns);
     }
 
-    return tokens;
+    return result->outcome;
 }
 
-static std::size_t get_grapheme_count(const std::string &s)
+// Like check_messages(), but over every field of the module at once, in a
+// single report with each line labelled by where it came from.
+template <typename Module>
+static check_outcome check_fields(report_writer &report, const Module &mod)
 {
-    auto it = s.begin();
-    std::size_t n = 0;
+    thread_local field_arena arena;
 
-    while (it != s.end()) {
-        std::size_t bytes = 1;
+    arena.clear();
+    timed(stage::metadata, [&] { collect_fields(mod, arena); });
+    if (arena.empty()) {
+        return check_outcome::no_message;
+    }
 
-        if ((*it & 0b10000000) != 0) {
-            while (((*it << bytes) & 0b11000000) == 0b10000000) {
-                bytes++;
-            }
-        }
+    auto text = arena.text();
 
-        it += bytes;
-        n++;
+    if (guess_mode) {
+        return guess_message(report, text);
     }
 
-    return n;
+    if (!timed(stage::scan, [&] { return message_charset->needs_remap(text); })) {
+        files_fast_path++;
+        return check_outcome::no_difference;
+    }
+
+    if (check_only) {
+        return timed(stage::scan, [&] { return message_charset->changes(text); }) ? check_outcome::difference : check_outcome::no_difference;
+    }
+
+    return check_text(report, text, [](std::uint32_t index) { return arena.fields()[index]; });
 }
 
-static void check_messages(const std::string &filename, const openmpt::module &mod)
+static check_outcome check_messages(report_writer &report, std::string_view message)
 {
-    auto message = mod.get_metadata("message_raw");
     if (message.empty()) {
-        return;
+        return check_outcome::no_message;
     }
 
-    auto codepoints = utf8_to_codepoints(message);
-    std::vector<std::uint32_t> converted;
+    if (guess_mode) {
+        return guess_message(report, message);
+    }
 
-    std::transform(codepoints.begin(), codepoints.end(), std::back_inserter(converted), cp437_to_unicode);
+    if (!timed(stage::scan, [&] { return message_charset->needs_remap(message); })) {
+        files_fast_path++;
+        return check_outcome::no_difference;
+    }
 
-    auto new_message = codepoints_to_utf8(converted);
+    // Which lines differ doesn't matter, so there's nothing to convert.
+    if (check_only) {
+        return timed(stage::scan, [&] { return message_charset->changes(message); }) ? check_outcome::difference : check_outcome::no_difference;
+    }
 
-    auto message_lines = split(message, '\n');
-    auto new_message_lines = split(new_message, '\n');
+    return check_text(report, message, [](std::uint32_t index) { return text_field{"", index + 1}; });
+}
+
+// Look at just enough of the file to let libopenmpt decide whether it
+// could be a module at all, so that text files, images and the like don't
+// need to go through a full (and much slower) load attempt.
+static bool probe_file(const void *data, std::size_t size)
+{
+    auto header = static_cast<const std::uint8_t *>(data);
+    auto header_size = std::min(size, openmpt::probe_file_header_get_recommended_size());
+
+    // "Want more data" can only happen for files smaller than the
+    // recommended probe size; let the real loader have the final say.
+    return openmpt::probe_file_header(openmpt::probe_file_header_flags_default, header, header_size, size) != openmpt::probe_file_header_result_failure;
+}
+
+// Opens the file, unless a prefetcher already has.
+static input_file open_input(const std::string &filename, prefetched_file *prefetched, bool named)
+{
+    if (prefetched != nullptr) {
+        if (prefetched->error != 0) {
+            throw std::system_error(prefetched->error, std::generic_category());
+        }
 
-    if (message_lines.size() != new_message_lines.size()) {
-        throw std::runtime_error("internal error: size mismatch");
+        if (prefetched->loaded) {
+            return input_file(std::move(prefetched->contents), prefetched->mtime);
+        }
     }
 
-    if (message == new_message) {
-        return;
+    return input_file(filename, full_load, named);
+}
+
+// Whether a file is big enough to be given to libopenmpt a window at a
+// time.
+static bool streamed(const input_file &input)
+{
+    return input.mapped() && input.size() >= stream_size;
+}
+
+// What checking a module file takes from the budget. Streaming only bounds
+// what's read from the file; with a full load, libopenmpt keeps its own
+// copy of the sample data anyway.
+static std::size_t module_cost(const input_file &input)
+{
+    return streamed(input) && !full_load ? stream_module::window_size : input.size();
+}
+
+// Checks a single module held in memory, from its native message if
+// that's enough, and otherwise by loading it with libopenmpt. If input is
+// given, it's the file the data came from, and large modules are streamed
+// from it instead. The caller reserves the memory for the data from the
+// budget.
+static check_outcome check_module_data(report_writer &report, const void *data, std::size_t size, const input_file *input, output_buffer &err)
+{
+    // Only the message is needed, and nothing has asked for the whole
+    // module to be loaded, so libopenmpt can often be skipped.
+    std::optional<std::pmr::string> native;
+    if ((use_native || cross_check) && !all_fields && !full_load) {
+        native = timed(stage::native, [&] { return native_message(data, size, scratch_arena::local().get()); });
     }
 
-    std::cout << "Difference in " << filename << ":\n\n";
+    if (native && !cross_check) {
+        files_native++;
+        return check_messages(report, *native);
+    }
 
-    for (std::size_t i = 0; i < message_lines.size(); i++) {
-        if (diff_only && message_lines[i] == new_message_lines[i]) {
-            continue;
+    auto check_module = [&](const auto &mod) {
+        if (all_fields) {
+            return check_fields(report, mod);
         }
 
-        auto graphemes = get_grapheme_count(message_lines[i]);
-        std::cout << message_lines[i];
-        if (graphemes < 80) {
-            std::string padding(80 - graphemes, ' ');
-            std::cout << padding;
+        auto message = timed(stage::metadata, [&] { return mod.get_metadata("message_raw"); });
+
+        if (native && std::string_view(*native) != message) {
+            cross_check_failures++;
+            err << "native message differs from libopenmpt's in " << report.name() << '\n';
         }
 
-        std::cout << " | " << new_message_lines[i] << std::endl;
+        return check_messages(report, message);
+    };
+
+    if (input != nullptr && streamed(*input)) {
+        files_streamed++;
+        return check_module(*timed(stage::parse, [&] { return std::make_unique<stream_module>(input->descriptor(), size, err.stream(), load_ctls); }));
     }
 
-    std::cout << std::endl;
+    return check_module(timed(stage::parse, [&] { return openmpt::module(data, size, err.stream(), load_ctls); }));
 }
 
-static void process_file(const std::string &filename)
+#ifdef HAVE_LIBARCHIVE
+// Checks each module in an archive as if it were a file named
+// "archive:member", decompressing members one at a time into a buffer
+// which is kept from one archive to the next, unless it has grown past
+// kept_member_capacity. Each member's size is reserved from the budget
+// before it's read (all of max_member_size, if the archive doesn't say).
+// Files in the archive which aren't modules are skipped, as they would
+// be on disk.
+//
+// Returns the most significant outcome of any member, or nothing if a
+// member or the archive itself couldn't be read, in which case the
+// reports of the members before it are kept.
+static constexpr std::size_t kept_member_capacity = 1024 * 1024;
+
+static std::optional<check_outcome> check_archive(const std::string &filename, const input_file &input, output_buffer &out, output_buffer &err)
 {
-    std::ifstream file(filename);
+    thread_local std::vector<char> contents;
+    thread_local std::string member;
+
+    check_outcome outcome = check_outcome::no_message;
+    bool complete = true;
 
     try {
-        openmpt::module mod(file);
-        check_messages(filename, mod);
+        archive_reader reader(input.data(), input.size());
+
+        while (reader.next(member)) {
+            auto name = filename + ':' + member;
+            report_writer report(out, output_format, name);
+
+            auto limit = reader.size().value_or(archive_reader::max_member_size);
+            if (limit > archive_reader::max_member_size) {
+                err << "skipping " << name << ": larger than " << archive_reader::max_member_size << " bytes\n";
+                continue;
+            }
+
+            std::optional<memory_budget::reservation> reserved;
+            if (budget != nullptr) {
+                reserved.emplace(*budget, limit);
+            }
+
+            // Given back before the reservation is.
+            struct shrink_buffer {
+                ~shrink_buffer()
+                {
+                    if (contents.capacity() > kept_member_capacity) {
+                        std::vector<char>().swap(contents);
+                    }
+                }
+            } shrink;
+
+            try {
+                if (!timed(stage::open, [&] { return reader.read(contents, limit); })) {
+                    err << "skipping " << name << ": larger than " << limit << " bytes\n";
+                    continue;
+                }
+
+                if (!timed(stage::probe, [&] { return probe_file(contents.data(), contents.size()); })) {
+                    files_not_modules++;
+                    report.not_module();
+                    continue;
+                }
+
+                auto member_outcome = check_module_data(report, contents.data(), contents.size(), nullptr, err);
+                report.finish(member_outcome);
+                outcome = std::max(outcome, member_outcome);
+            } catch (const std::exception &e) {
+                report.fail(e.what());
+                err << "can't open " << name << ": " << e.what() << '\n';
+                complete = false;
+            }
+        }
     } catch (const std::exception &e) {
-        std::cerr << "can't open " << filename << ": " << e.what() << std::endl;
+        report_writer(out, output_format, filename).fail(e.what());
+        err << "can't read archive " << filename << ": " << e.what() << '\n';
+        complete = false;
+    }
+
+    if (!complete) {
+        return std::nullopt;
+    }
+
+    return outcome;
+}
+#endif
+
+// Report output goes to out and diagnostics (including libopenmpt's own
+// log messages) to err, so that callers running several files at once
+// can keep each file's text together.
+static void process_file(const std::string &filename, output_buffer &out, output_buffer &err, prefetched_file *prefetched, bool named)
+{
+    auto mark = out.size();
+    report_writer report(out, output_format, filename);
+    file_timer file(filename);
+
+    try {
+        auto input = timed(stage::open, [&] { return open_input(filename, prefetched, named); });
+        file.bytes = input.size();
+
+        bool archive = false;
+#ifdef HAVE_LIBARCHIVE
+        archive = looks_like_archive(input.data(), input.size());
+#endif
+
+        if (!archive && !timed(stage::probe, [&] { return probe_file(input.data(), input.size()); })) {
+            files_not_modules++;
+            report.not_module();
+            return;
+        }
+
+        // Taken before the file is read through for the cache hash. A
+        // file read ahead already holds its reservation; unless it's an
+        // archive, it's now counted as a file being checked. An archive's
+        // members are reserved one at a time as they're read, and while
+        // they wait for room, read-ahead can't hold them up.
+        std::optional<memory_budget::reservation> reserved;
+        if (prefetched != nullptr && prefetched->reserved != nullptr) {
+            if (!archive) {
+                prefetched->reserved->hand_off();
+            }
+        } else if (budget != nullptr && !archive) {
+            reserved.emplace(*budget, module_cost(input));
+        }
+
+        std::optional<file_key> key;
+        if (cache != nullptr && input.regular()) {
+            key = {input.size(), input.mtime(), timed(stage::hash, [&] { return xxh64(input.data(), input.size()); })};
+
+            if (auto cached = cache->lookup(filename, *key)) {
+                out << cached->report;
+                if (cached->outcome == check_outcome::difference) {
+                    files_differing++;
+                }
+                return;
+            }
+        }
+
+        std::optional<check_outcome> outcome;
+        if (archive) {
+#ifdef HAVE_LIBARCHIVE
+            outcome = check_archive(filename, input, out, err);
+#endif
+        } else {
+            outcome = check_module_data(report, input.data(), input.size(), &input, err);
+            report.finish(*outcome);
+        }
+
+        if (key && outcome) {
+            cache->store(filename, *key, *outcome, out.view().substr(mark));
+        }
+
+        if (!outcome) {
+            files_failed++;
+        } else if (*outcome == check_outcome::difference) {
+            files_differing++;
+        }
+    } catch (const std::exception &e) {
+        files_failed++;
+
+        // Don't leave half a report behind.
+        report.fail(e.what());
+        err << "can't open " << filename << ": " << e.what() << '\n';
+    }
+}
+
+static void run_file(work_pool &pool, const std::string &filename, bool named, ordered_output &output, ordered_output::ticket slot, prefetched_file *prefetched = nullptr)
+{
+    // Each worker thread formats into its own buffers, which are reused
+    // from one file to the next.
+    thread_local output_buffer out;
+    thread_local output_buffer err;
+
+    // With --check, the first difference settles the answer, and the
+    // files still to come are skipped.
+    if (!pool.cancelled()) {
+        process_file(filename, out, err, prefetched, named);
+        if (stop_at_difference && files_differing > 0) {
+            pool.cancel();
+        }
+    }
+
+    timed(stage::write, [&] { output.complete(slot, out, err); });
+
+    out.clear();
+    err.clear();
+    scratch_arena::local().reset();
+}
+
+static bool in_shard(const std::string &filename)
+{
+    return shard_count == 1 || xxh64(filename) % shard_count == shard_index;
+}
+
+// For --group: one report for each different message, followed by the
+// other files it was found in.
+static void print_groups()
+{
+    output_buffer out;
+
+    for (const auto &group : dedup->groups()) {
+        report_writer report(out, report_format::text, group.files.front());
+
+        for (std::size_t i = 0; i < group.result->size(); i++) {
+            auto line = (*group.result)[i];
+            report.line({"", line.index + 1}, line.original, line.converted, line.columns);
+        }
+        report.finish(check_outcome::difference);
+
+        if (group.files.size() > 1) {
+            out << "Same message in " << group.files.size() - 1 << " more file(s):\n";
+            for (auto it = group.files.begin() + 1; it != group.files.end(); ++it) {
+                out << "    " << *it << '\n';
+            }
+            out << '\n';
+        }
+    }
+
+    std::cout << out.view() << std::flush;
+}
+
+// Checks one request for --serve, the same way as a file named on the
+// command line, except that a path must be a regular file: a client
+// shouldn't be able to tie up a worker with a FIFO.
+static void serve_file(serve_request &request, std::string &reply)
+{
+    static std::mutex log_mutex;
+    thread_local output_buffer out;
+    thread_local output_buffer err;
+
+    if (request.data) {
+        prefetched_file file{request.name, 0, true, std::move(*request.data), 0, std::move(request.reserved)};
+        process_file(request.name, out, err, &file, false);
+    } else {
+        process_file(request.name, out, err, nullptr, false);
+    }
+
+    reply.append(out.view());
+    if (!err.empty()) {
+        std::lock_guard lock(log_mutex);
+        std::cerr << err.view() << std::flush;
+    }
+
+    out.clear();
+    err.clear();
+    scratch_arena::local().reset();
+}
+
+static void usage()
+{
+    std::cerr << "usage: openmpt-charset [-0afv] [-j jobs] [-T list] [--all-fields] [--cache file]\n"
+                 "                       [--cache-stats] [--charset name] [--check | --count]\n"
+                 "                       [--cross-check] [--ext list] [--format text|jsonl|binary]\n"
+                 "                       [--group] [--guess] [--min-size size] [--max-size size]\n"
+                 "                       [--memory-budget size] [--newer file]\n"
+                 "                       [--native] [--no-dedup] [--prefetch window] [--stats]\n"
+                 "                       [--shard index/count] [--stream-size size]\n"
+                 "                       [file|directory...]\n"
+                 "       openmpt-charset --serve socket [options]\n"
+                 "       openmpt-charset --merge [--stats] report..." << std::endl;
+    std::exit(1);
+}
+
+// Hand each path in the list to the walker as soon as it has been read,
+// so checking starts right away and the list never has to be held in
+// memory. The walker's pool limits how far reading can run ahead.
+static void read_file_list(const char *listname, char delimiter, tree_walker &walker, const work_pool &pool)
+{
+    std::ifstream file;
+    std::istream *list = &std::cin;
+
+    if (std::string_view(listname) != "-") {
+        file.open(listname, std::ios::binary);
+        if (!file) {
+            std::cerr << "can't open " << listname << ": " << std::strerror(errno) << std::endl;
+            std::exit(1);
+        }
+        list = &file;
+    }
+
+    std::string path;
+    while (!pool.cancelled() && std::getline(*list, path, delimiter)) {
+        if (!path.empty()) {
+            walker.submit(path);
+        }
+    }
+
+    if (list->bad()) {
+        std::cerr << "error reading " << listname << std::endl;
+    }
+}
+
+// Everything which changes what a report looks like, or how the file
+// behind it is read; cached reports are only reused by runs with the same
+// settings. Files read ahead by the prefetcher are never streamed, so
+// whether it runs is part of the stream mode.
+static std::string cache_signature(bool prefetched)
+{
+    std::string signature = "diff_only=";
+
+    signature += diff_only ? '1' : '0';
+    signature += " charset=";
+    signature += message_charset->name;
+    signature += guess_mode ? " guess=1" : " guess=0";
+    signature += all_fields ? " fields=1" : " fields=0";
+    signature += " format=";
+    signature += std::to_string(int(output_format));
+    signature += check_only ? " check=1" : " check=0";
+    signature += use_native ? " native=1" : " native=0";
+    signature += cross_check ? " cross_check=1" : " cross_check=0";
+    signature += full_load ? " full_load=1" : " full_load=0";
+    signature += " stream=";
+    signature += std::to_string(stream_size);
+    signature += prefetched ? " prefetch=1" : " prefetch=0";
+
+    return signature;
+}
+
+// A byte count, optionally followed by k, m or g.
+static std::uintmax_t parse_size(const char *arg)
+{
+    char *end;
+    std::uintmax_t n = std::strtoumax(arg, &end, 10);
+
+    if (end == arg) {
+        std::cerr << "invalid size: " << arg << std::endl;
+        std::exit(1);
+    }
+
+    switch (std::tolower(static_cast<unsigned char>(*end))) {
+    case 'g':
+        n *= 1024;
+        [[fallthrough]];
+    case 'm':
+        n *= 1024;
+        [[fallthrough]];
+    case 'k':
+        n *= 1024;
+        end++;
+        break;
+    }
+
+    if (*end != '\0') {
+        std::cerr << "invalid size: " << arg << std::endl;
+        std::exit(1);
+    }
+
+    return n;
+}
+
+// A comma-separated list of extensions, with or without leading dots.
+static std::vector<std::string> parse_extensions(std::string_view arg)
+{
+    std::vector<std::string> extensions;
+
+    while (!arg.empty()) {
+        auto comma = arg.find(',');
+        auto ext = arg.substr(0, comma);
+        arg.remove_prefix(comma == std::string_view::npos ? arg.size() : comma + 1);
+
+        if (!ext.empty() && ext.front() == '.') {
+            ext.remove_prefix(1);
+        }
+
+        if (!ext.empty()) {
+            std::string lower(ext);
+            std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c) { return std::tolower(c); });
+            extensions.push_back(std::move(lower));
+        }
     }
+
+    return extensions;
 }
 
 int main(int argc, char **argv)
 {
-    for (int i = 1; i < argc; i++) {
-        process_file(argv[i]);
+    enum {
+        opt_all_fields = 256,
+        opt_cache,
+        opt_cache_stats,
+        opt_charset,
+        opt_check,
+        opt_count,
+        opt_cross_check,
+        opt_ext,
+        opt_format,
+        opt_group,
+        opt_guess,
+        opt_max_size,
+        opt_memory_budget,
+        opt_merge,
+        opt_min_size,
+        opt_native,
+        opt_newer,
+        opt_no_dedup,
+        opt_prefetch,
+        opt_serve,
+        opt_shard,
+        opt_stats,
+        opt_stream_size,
+    };
+    static const struct option longopts[] = {
+        {"all-fields", no_argument, nullptr, opt_all_fields},
+        {"all-lines", no_argument, nullptr, 'a'},
+        {"cache", required_argument, nullptr, opt_cache},
+        {"cache-stats", no_argument, nullptr, opt_cache_stats},
+        {"charset", required_argument, nullptr, opt_charset},
+        {"check", no_argument, nullptr, opt_check},
+        {"count", no_argument, nullptr, opt_count},
+        {"cross-check", no_argument, nullptr, opt_cross_check},
+        {"ext", required_argument, nullptr, opt_ext},
+        {"format", required_argument, nullptr, opt_format},
+        {"files-from", required_argument, nullptr, 'T'},
+        {"full-load", no_argument, nullptr, 'f'},
+        {"group", no_argument, nullptr, opt_group},
+        {"guess", no_argument, nullptr, opt_guess},
+        {"jobs", required_argument, nullptr, 'j'},
+        {"max-size", required_argument, nullptr, opt_max_size},
+        {"memory-budget", required_argument, nullptr, opt_memory_budget},
+        {"merge", no_argument, nullptr, opt_merge},
+        {"min-size", required_argument, nullptr, opt_min_size},
+        {"native", no_argument, nullptr, opt_native},
+        {"newer", required_argument, nullptr, opt_newer},
+        {"no-dedup", no_argument, nullptr, opt_no_dedup},
+        {"null", no_argument, nullptr, '0'},
+        {"prefetch", required_argument, nullptr, opt_prefetch},
+        {"serve", required_argument, nullptr, opt_serve},
+        {"shard", required_argument, nullptr, opt_shard},
+        {"stats", no_argument, nullptr, opt_stats},
+        {"stream-size", required_argument, nullptr, opt_stream_size},
+        {"verbose", no_argument, nullptr, 'v'},
+        {nullptr, 0, nullptr, 0},
+    };
+    unsigned jobs = 1;
+    std::size_t prefetch_window = 0;
+    walk_filter filter;
+    const char *file_list = nullptr;
+    const char *cache_path = nullptr;
+    const char *serve_path = nullptr;
+    bool cache_stats = false;
+    bool use_dedup = true;
+    bool merge = false;
+    bool count = false;
+    char list_delimiter = '\n';
+    int ch;
+
+    // Reports are written with write() by ordered_output; iostreams are
+    // left only for usage and summary messages, which don't need to be
+    // kept in step with C stdio.
+    std::ios::sync_with_stdio(false);
+
+    while ((ch = getopt_long(argc, argv, "0afj:T:v", longopts, nullptr)) != -1) {
+        switch (ch) {
+        case '0':
+            list_delimiter = '\0';
+            break;
+        case 'T':
+            file_list = optarg;
+            break;
+        case 'a':
+            diff_only = false;
+            break;
+        case 'f':
+            full_load = true;
+            break;
+        case 'j': {
+            char *end;
+            unsigned long n = std::strtoul(optarg, &end, 10);
+            if (*optarg == '\0' || *end != '\0' || n > 1024) {
+                std::cerr << "invalid job count: " << optarg << std::endl;
+                std::exit(1);
+            }
+            jobs = n == 0 ? std::max(1u, std::thread::hardware_concurrency()) : n;
+            break;
+        }
+        case 'v':
+            verbose = true;
+            break;
+        case opt_all_fields:
+            all_fields = true;
+            break;
+        case opt_cache:
+            cache_path = optarg;
+            break;
+        case opt_cache_stats:
+            cache_stats = true;
+            break;
+        case opt_charset:
+            message_charset = find_charset(optarg);
+            if (message_charset == nullptr) {
+                std::cerr << "unknown charset: " << optarg << "; known charsets are:";
+                for (const auto &cs : all_charsets()) {
+                    std::cerr << ' ' << cs.name;
+                }
+                std::cerr << std::endl;
+                std::exit(1);
+            }
+            break;
+        case opt_check:
+            check_only = true;
+            stop_at_difference = true;
+            break;
+        case opt_count:
+            check_only = true;
+            count = true;
+            break;
+        case opt_cross_check:
+            cross_check = true;
+            break;
+        case opt_ext:
+            filter.extensions = parse_extensions(optarg);
+            break;
+        case opt_format:
+            if (std::strcmp(optarg, "text") == 0) {
+                output_format = report_format::text;
+            } else if (std::strcmp(optarg, "jsonl") == 0) {
+                output_format = report_format::jsonl;
+            } else if (std::strcmp(optarg, "binary") == 0) {
+                output_format = report_format::binary;
+            } else {
+                std::cerr << "unknown format: " << optarg << "; known formats are: text jsonl binary" << std::endl;
+                std::exit(1);
+            }
+            break;
+        case opt_group:
+            group_files = true;
+            break;
+        case opt_guess:
+            guess_mode = true;
+            break;
+        case opt_max_size:
+            filter.max_size = parse_size(optarg);
+            break;
+        case opt_memory_budget:
+            budget = std::make_unique<memory_budget>(parse_size(optarg));
+            break;
+        case opt_merge:
+            merge = true;
+            break;
+        case opt_min_size:
+            filter.min_size = parse_size(optarg);
+            break;
+        case opt_native:
+            use_native = true;
+            break;
+        case opt_newer: {
+            std::error_code ec;
+            filter.newer_than = std::filesystem::last_write_time(optarg, ec);
+            if (ec) {
+                std::cerr << "can't stat " << optarg << ": " << ec.message() << std::endl;
+                std::exit(1);
+            }
+            break;
+        }
+        case opt_no_dedup:
+            use_dedup = false;
+            break;
+        case opt_prefetch: {
+            char *end;
+            unsigned long n = std::strtoul(optarg, &end, 10);
+            if (*optarg == '\0' || *end != '\0' || n > 4096) {
+                std::cerr << "invalid prefetch window: " << optarg << std::endl;
+                std::exit(1);
+            }
+            prefetch_window = n;
+            break;
+        }
+        case opt_serve:
+            serve_path = optarg;
+            break;
+        case opt_shard: {
+            char *slash, *end;
+            shard_index = std::strtoull(optarg, &slash, 10);
+            if (slash == optarg || *slash != '/' || slash[1] == '\0') {
+                shard_count = 0;
+            } else {
+                shard_count = std::strtoull(slash + 1, &end, 10);
+                if (*end != '\0') {
+                    shard_count = 0;
+                }
+            }
+            if (shard_count == 0 || shard_index >= shard_count) {
+                std::cerr << "invalid shard: " << optarg << "; expected index/count, with the index from 0 to count-1" << std::endl;
+                std::exit(1);
+            }
+            break;
+        }
+        case opt_stats:
+            stats_enabled = true;
+            break;
+        case opt_stream_size:
+            stream_size = parse_size(optarg);
+            break;
+        default:
+            usage();
+        }
+    }
+
+    if (merge) {
+        if (optind == argc || file_list != nullptr || serve_path != nullptr) {
+            usage();
+        }
+
+        try {
+            auto merged = merge_reports(std::vector<std::string>(argv + optind, argv + argc), std::cout);
+            if (stats_enabled && merged) {
+                stats_print(merged->stats, merged->elapsed_ns / 1e9, std::cerr);
+            }
+        } catch (const std::exception &e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+
+        if (!std::cout) {
+            std::cerr << "openmpt-charset: error writing output" << std::endl;
+            return 1;
+        }
+
+        return 0;
+    }
+
+    if (serve_path != nullptr) {
+        if (optind != argc || file_list != nullptr) {
+            usage();
+        }
+
+        // Replies are always records.
+        output_format = report_format::jsonl;
+    } else if (optind == argc && file_list == nullptr) {
+        usage();
+    }
+
+    // Grouping happens after the reports are written, and only for messages.
+    if (group_files && (serve_path != nullptr || cache_path != nullptr || output_format != report_format::text || all_fields || guess_mode)) {
+        std::cerr << "--group can't be used with --all-fields, --cache, --format, --guess or --serve" << std::endl;
+        std::exit(1);
+    }
+
+    // Nothing is printed for each file, and the exit status or count
+    // covers only the messages (or fields) differing.
+    if (check_only && (stop_at_difference == count || serve_path != nullptr || output_format != report_format::text || group_files || guess_mode)) {
+        std::cerr << "--check and --count can't be used together, or with --format, --group, --guess or --serve" << std::endl;
+        std::exit(1);
+    }
+
+    if ((use_dedup && !check_only) || group_files) {
+        dedup = std::make_unique<text_dedup>(dedup_limit, group_files);
+    }
+
+    if (!full_load) {
+        load_ctls = {
+            {"load.skip_samples", "1"},
+            {"load.skip_plugins", "1"},
+            {"load.skip_subsongs_init", "1"},
+        };
+
+        // Pattern names are stored with the patterns.
+        if (!all_fields) {
+            load_ctls.emplace("load.skip_patterns", "1");
+        }
+    }
+
+    if (cache_path != nullptr) {
+        try {
+            cache = std::make_unique<result_cache>(cache_path, cache_signature(prefetch_window > 0));
+        } catch (const std::exception &e) {
+            std::cerr << e.what() << std::endl;
+            std::exit(1);
+        }
+    }
+
+    ordered_output output;
+    auto start = std::chrono::steady_clock::now();
+
+    {
+        // With a single job, everything runs on the main thread, unless
+        // files are prefetched: then the main thread feeds the prefetcher,
+        // which needs a worker to hand files to.
+        // A server always has workers, so that each connection's thread
+        // only has to read requests.
+        work_pool pool(jobs > 1 || prefetch_window > 0 || serve_path != nullptr ? jobs : 0, jobs * 64);
+        std::unique_ptr<prefetcher> prefetch;
+        if (prefetch_window > 0) {
+            prefetch = std::make_unique<prefetcher>(pool, prefetch_window, prefetch_max_size, budget.get());
+        }
+
+        tree_walker walker(pool, output, std::move(filter), [&output, &prefetch, &pool](const std::string &filename, ordered_output::ticket slot, bool named) {
+            static const output_buffer nothing;
+
+            if (!in_shard(filename)) {
+                files_other_shards++;
+                output.complete(slot, nothing, nothing);
+            } else if (pool.cancelled()) {
+                output.complete(slot, nothing, nothing);
+            } else if (prefetch != nullptr) {
+                prefetch->submit(filename, [&output, &pool, slot, named](prefetched_file &file) { run_file(pool, file.path, named, output, slot, &file); });
+            } else {
+                run_file(pool, filename, named, output, slot);
+            }
+        });
+
+        for (int i = optind; i < argc; i++) {
+            walker.submit(argv[i]);
+        }
+
+        if (file_list != nullptr) {
+            read_file_list(file_list, list_delimiter, walker, pool);
+        }
+
+        if (serve_path != nullptr) {
+            try {
+                serve(serve_path, pool, serve_file, budget.get());
+            } catch (const std::system_error &e) {
+                std::cerr << "can't serve on " << serve_path << ": " << e.what() << std::endl;
+                std::exit(1);
+            }
+        }
+
+        pool.wait();
+    }
+
+    if (group_files) {
+        print_groups();
+    }
+
+    if (stats_enabled) {
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        auto stats = stats_collect();
+
+        // Machine-readable reports carry their stats along, for --merge.
+        if (output_format != report_format::text && serve_path == nullptr) {
+            output_buffer out;
+            output_buffer err;
+            write_stats(out, output_format, stats, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+            output.complete(output.reserve(), out, err);
+        }
+
+        stats_print(stats, elapsed.count(), std::cerr);
+    }
+
+    if (count) {
+        std::cout << files_differing << std::endl;
+    }
+
+    if (verbose) {
+        std::cerr << files_not_modules << " file(s) skipped: not a module" << std::endl;
+        std::cerr << files_fast_path << " file(s) with plain ASCII messages" << std::endl;
+        std::cerr << files_native << " file(s) read without libopenmpt" << std::endl;
+        std::cerr << files_streamed << " file(s) streamed" << std::endl;
+        if (shard_count > 1) {
+            std::cerr << files_other_shards << " file(s) left to other shards" << std::endl;
+        }
+        if (dedup != nullptr) {
+            std::cerr << dedup->hits() << " message(s) reused from other files" << std::endl;
+        }
+        if (budget != nullptr) {
+            std::cerr << "memory budget: peak " << budget->peak() << " byte(s) reserved" << std::endl;
+        }
+    }
+
+    if (cache != nullptr && cache_stats) {
+        auto stats = cache->stats();
+        std::cerr << "cache: " << stats.hits << " hit(s), " << stats.new_files << " new file(s), "
+                  << stats.changed_files << " changed file(s), " << stats.written << " record(s) written" << std::endl;
+    }
+
+    // Make sure everything is on disk before exiting.
+    cache.reset();
+
+    if (cross_check_failures > 0) {
+        std::cerr << "openmpt-charset: " << cross_check_failures << " file(s) failed the cross-check" << std::endl;
+        return 1;
+    }
+
+    if (output.failed()) {
+        std::cerr << "openmpt-charset: error writing output" << std::endl;
+        return 1;
+    }
+
+    // As with cmp and diff: 1 for a difference, 2 if there may have been
+    // one in a file which couldn't be checked.
+    if (stop_at_difference) {
+        return files_differing > 0 ? 1 : files_failed > 0 ? 2 : 0;
     }
 
     return 0;
@@ -0,0 +1,134 @@
+/*-
+ * Copyright (c) 2023 Chris Spiegel
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <cerrno>
+
+#include <unistd.h>
+
+#include "output.hpp"
+
+void output_buffer::pad(std::size_t n)
+{
+    static constexpr std::string_view spaces = "                                                                                ";
+
+    while (n > 0) {
+        auto chunk = std::min(n, spaces.size());
+        text.append(spaces.substr(0, chunk));
+        n -= chunk;
+    }
+}
+
+ordered_output::ticket ordered_output::reserve()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    return slots.emplace(slots.end());
+}
+
+std::vector<ordered_output::ticket> ordered_output::reserve_after(ticket t, std::size_t n)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<ticket> tickets;
+    auto next = std::next(t);
+
+    tickets.reserve(n);
+    for (std::size_t i = 0; i < n; i++) {
+        tickets.push_back(slots.emplace(next));
+    }
+
+    return tickets;
+}
+
+void ordered_output::complete(ticket t, const output_buffer &out, const output_buffer &err)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (t != slots.begin()) {
+        t->out.assign(out.view());
+        t->err.assign(err.view());
+        t->done = true;
+        return;
+    }
+
+    emit(out.view(), err.view());
+    slots.pop_front();
+
+    while (!slots.empty() && slots.front().done) {
+        emit(slots.front().out, slots.front().err);
+        slots.pop_front();
+    }
+
+    flush_batch();
+}
+
+bool ordered_output::failed()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    return write_failed;
+}
+
+void ordered_output::emit(std::string_view out, std::string_view err)
+{
+    if (!out.empty()) {
+        if (batch.size() + out.size() > write_size) {
+            flush_batch();
+        }
+
+        if (out.size() >= write_size) {
+            write_all(STDOUT_FILENO, out);
+        } else {
+            batch.append(out);
+        }
+    }
+
+    if (!err.empty()) {
+        flush_batch();
+        write_all(STDERR_FILENO, err);
+    }
+}
+
+void ordered_output::flush_batch()
+{
+    write_all(STDOUT_FILENO, batch);
+    batch.clear();
+}
+
+void ordered_output::write_all(int fd, std::string_view s)
+{
+    while (!s.empty() && !write_failed) {
+        ssize_t n = write(fd, s.data(), s.size());
+        if (n == -1) {
+            if (errno != EINTR) {
+                write_failed = true;
+            }
+            continue;
+        }
+
+        s.remove_prefix(n);
+    }
+}
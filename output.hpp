@@ -0,0 +1,160 @@
+/*-
+ * Copyright (c) 2023 Chris Spiegel
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef OPENMPT_CHARSET_OUTPUT_HPP
+#define OPENMPT_CHARSET_OUTPUT_HPP
+
+#include <charconv>
+#include <concepts>
+#include <cstddef>
+#include <list>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Text destined for standard output or standard error, built up in
+// memory. Clearing the buffer keeps its storage, so a buffer reused for
+// file after file stops allocating once it has grown to fit the largest
+// report.
+class output_buffer {
+public:
+    output_buffer() : sb(text), os(&sb) {}
+
+    output_buffer(const output_buffer &) = delete;
+    output_buffer &operator=(const output_buffer &) = delete;
+
+    output_buffer &operator<<(std::string_view s) { text.append(s); return *this; }
+    output_buffer &operator<<(char c) { text.push_back(c); return *this; }
+
+    template <std::integral T> requires (!std::same_as<T, char> && !std::same_as<T, bool>)
+    output_buffer &operator<<(T n)
+    {
+        char buf[24];
+        auto result = std::to_chars(buf, buf + sizeof buf, n);
+        text.append(buf, result.ptr);
+        return *this;
+    }
+
+    // Append n spaces.
+    void pad(std::size_t n);
+
+    std::string_view view() const { return text; }
+    std::size_t size() const { return text.size(); }
+    bool empty() const { return text.empty(); }
+    void clear() { text.clear(); }
+
+    // Drop anything added after the buffer was size bytes long.
+    void truncate(std::size_t size) { text.resize(size); }
+
+    // Replace the bytes starting at pos, which must already be there.
+    void overwrite(std::size_t pos, std::string_view s) { s.copy(text.data() + pos, s.size()); }
+
+    // A std::ostream which appends to this buffer, for interfaces (such as
+    // libopenmpt's log) which want one.
+    std::ostream &stream() { return os; }
+
+private:
+    class appending_streambuf : public std::streambuf {
+    public:
+        explicit appending_streambuf(std::string &text) : text(text) {}
+
+    protected:
+        std::streamsize xsputn(const char *s, std::streamsize n) override { text.append(s, n); return n; }
+        int_type overflow(int_type c) override
+        {
+            if (!traits_type::eq_int_type(c, traits_type::eof())) {
+                text.push_back(traits_type::to_char_type(c));
+            }
+
+            return traits_type::not_eof(c);
+        }
+
+    private:
+        std::string &text;
+    };
+
+    std::string text;
+    appending_streambuf sb;
+    std::ostream os;
+};
+
+// Collects per-file reports, which may be finished in any order by the
+// worker pool, and writes them out in the order their slots were
+// reserved. A report is written as soon as every report before it has
+// been written, so output streams out while later files are still being
+// processed.
+//
+// Output goes straight to file descriptors 1 and 2 with write(), not
+// through iostreams. Reports which become ready together are gathered
+// into one write() of up to write_size bytes; a report which is ready
+// on its own gets one write() to itself. Standard error text is never
+// gathered: it is written as soon as the standard output text before it
+// is, one block per file, so messages from different files can't
+// interleave.
+class ordered_output {
+    struct slot {
+        bool done = false;
+        std::string out;
+        std::string err;
+    };
+
+public:
+    using ticket = std::list<slot>::iterator;
+
+    static constexpr std::size_t write_size = 64 * 1024;
+
+    // Reserve the next position in the output.
+    ticket reserve();
+
+    // Reserve n slots immediately after t, which must not have been
+    // completed yet. This lets the entries of a directory take their
+    // places in the output right where the directory itself was named.
+    std::vector<ticket> reserve_after(ticket t, std::size_t n);
+
+    // Provide the standard output and standard error text for a reserved
+    // slot. The buffers are copied if they can't be written right away,
+    // so the caller is free to reuse them as soon as this returns.
+    void complete(ticket t, const output_buffer &out, const output_buffer &err);
+
+    // Whether any write has failed (for example, because the disk is
+    // full). Output stops at the first failure.
+    bool failed();
+
+private:
+    void emit(std::string_view out, std::string_view err);
+    void flush_batch();
+    void write_all(int fd, std::string_view s);
+
+    std::mutex mutex;
+    std::list<slot> slots;
+    std::string batch;
+    bool write_failed = false;
+};
+
+#endif
@@ -0,0 +1,550 @@
+/*-
+ * Copyright (c) 2023 Chris Spiegel
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define PREFETCH_IO_URING 1
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include "prefetch.hpp"
+
+struct prefetcher::request {
+    prefetched_file file;
+    handler done;
+
+#ifdef PREFETCH_IO_URING
+    int fd = -1;
+    std::size_t done_bytes = 0;
+    struct statx stx;
+#endif
+};
+
+#ifdef PREFETCH_IO_URING
+// Just enough of io_uring to submit requests and reap completions, using
+// the system calls directly so that liburing isn't needed.
+class prefetcher::ring {
+public:
+    // Returns nullptr if io_uring can't be used for the operations the
+    // prefetcher needs.
+    static std::unique_ptr<ring> create(unsigned entries)
+    {
+        std::unique_ptr<ring> r(new ring);
+        return r->setup(entries) ? std::move(r) : nullptr;
+    }
+
+    ~ring()
+    {
+        if (sqes != MAP_FAILED) {
+            munmap(sqes, sqes_size);
+        }
+        if (cq_ptr != MAP_FAILED && cq_ptr != sq_ptr) {
+            munmap(cq_ptr, cq_size);
+        }
+        if (sq_ptr != MAP_FAILED) {
+            munmap(sq_ptr, sq_size);
+        }
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+
+    // A cleared submission queue entry; the caller must not ask for more
+    // entries than the ring was created with before calling enter().
+    io_uring_sqe &next(std::uint8_t opcode, std::uint64_t user_data)
+    {
+        unsigned tail = *sq_tail + pending;
+        unsigned index = tail & *sq_mask;
+        auto &sqe = sqes[index];
+
+        sqe = {};
+        sqe.opcode = opcode;
+        sqe.user_data = user_data;
+        sq_array[index] = index;
+        pending++;
+
+        return sqe;
+    }
+
+    // Submits everything queued with next() and waits for at least one
+    // completion.
+    void enter()
+    {
+        std::atomic_ref<unsigned>(*sq_tail).store(*sq_tail + pending, std::memory_order_release);
+
+        while (syscall(__NR_io_uring_enter, fd, pending, 1, IORING_ENTER_GETEVENTS, nullptr, 0) == -1 && errno == EINTR) {
+        }
+
+        pending = 0;
+    }
+
+    template <typename F>
+    void reap(F f)
+    {
+        unsigned head = *cq_head;
+        unsigned tail = std::atomic_ref<unsigned>(*cq_tail).load(std::memory_order_acquire);
+
+        for (; head != tail; head++) {
+            const auto &cqe = cqes[head & *cq_mask];
+            f(cqe.user_data, cqe.res);
+        }
+
+        std::atomic_ref<unsigned>(*cq_head).store(head, std::memory_order_release);
+    }
+
+private:
+    ring() = default;
+
+    bool setup(unsigned entries)
+    {
+        io_uring_params params{};
+
+        fd = syscall(__NR_io_uring_setup, entries, &params);
+        if (fd == -1 || !supported()) {
+            return false;
+        }
+
+        sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            sq_size = cq_size = std::max(sq_size, cq_size);
+        }
+
+        sq_ptr = mmap(nullptr, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sq_ptr == MAP_FAILED) {
+            return false;
+        }
+
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            cq_ptr = sq_ptr;
+        } else {
+            cq_ptr = mmap(nullptr, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+            if (cq_ptr == MAP_FAILED) {
+                return false;
+            }
+        }
+
+        sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = static_cast<io_uring_sqe *>(mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+        if (sqes == MAP_FAILED) {
+            return false;
+        }
+
+        auto sq = static_cast<char *>(sq_ptr);
+        auto cq = static_cast<char *>(cq_ptr);
+        sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+        sq_mask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+        sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+        cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+        cq_mask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+
+        return true;
+    }
+
+    // Opening and statting files through io_uring needs Linux 5.6.
+    bool supported()
+    {
+        constexpr unsigned nops = 64;
+        std::vector<char> storage(sizeof(io_uring_probe) + nops * sizeof(io_uring_probe_op));
+        auto probe = reinterpret_cast<io_uring_probe *>(storage.data());
+
+        if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, nops) == -1) {
+            return false;
+        }
+
+        for (auto op : {IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ, IORING_OP_POLL_ADD}) {
+            if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    int fd = -1;
+    unsigned pending = 0;
+
+    void *sq_ptr = MAP_FAILED;
+    void *cq_ptr = MAP_FAILED;
+    io_uring_sqe *sqes = static_cast<io_uring_sqe *>(MAP_FAILED);
+    std::size_t sq_size = 0;
+    std::size_t cq_size = 0;
+    std::size_t sqes_size = 0;
+
+    unsigned *sq_tail = nullptr;
+    unsigned *sq_mask = nullptr;
+    unsigned *sq_array = nullptr;
+    unsigned *cq_head = nullptr;
+    unsigned *cq_tail = nullptr;
+    unsigned *cq_mask = nullptr;
+    io_uring_cqe *cqes = nullptr;
+};
+#else
+class prefetcher::ring {
+};
+#endif
+
+prefetcher::prefetcher(work_pool &pool, std::size_t window, std::size_t max_size, memory_budget *budget) : pool(pool), window(std::max<std::size_t>(window, 1)), max_size(max_size), budget(budget)
+{
+#ifdef PREFETCH_IO_URING
+    // Each file has one operation in flight at a time, and the wakeup poll
+    // needs one more.
+    uring = ring::create(this->window + 1);
+    if (uring != nullptr) {
+        event_fd = eventfd(0, EFD_CLOEXEC);
+        if (event_fd != -1) {
+            // The ring thread can't wait for room in the budget, so it's
+            // woken to try again whenever some is given back.
+            if (budget != nullptr) {
+                budget->watch([this] { wake(); });
+            }
+            threads.emplace_back(&prefetcher::run_ring, this);
+            return;
+        }
+
+        uring.reset();
+    }
+#endif
+
+    for (std::size_t i = 0; i < std::min<std::size_t>(this->window, 16); i++) {
+        threads.emplace_back(&prefetcher::run_blocking, this);
+    }
+}
+
+prefetcher::~prefetcher()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    cv.notify_all();
+    wake();
+
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    if (event_fd != -1) {
+        if (budget != nullptr) {
+            budget->watch(nullptr);
+        }
+        close(event_fd);
+    }
+}
+
+void prefetcher::submit(std::string path, handler done)
+{
+    auto r = std::make_shared<request>();
+    r->file.path = std::move(path);
+    r->done = std::move(done);
+
+    pool.hold();
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        waiting.push_back(std::move(r));
+    }
+    cv.notify_one();
+    wake();
+}
+
+// The next file to start on, if the window has room; called with the
+// mutex held.
+std::shared_ptr<prefetcher::request> prefetcher::take()
+{
+    if (waiting.empty() || outstanding >= window) {
+        return nullptr;
+    }
+
+    auto r = std::move(waiting.front());
+    waiting.pop_front();
+    outstanding++;
+
+    return r;
+}
+
+void prefetcher::finish(std::shared_ptr<request> r)
+{
+    pool.submit_held([this, r]() mutable {
+        r->done(r->file);
+
+        // The contents have to be gone before there's room for more.
+        r.reset();
+        release();
+    });
+}
+
+void prefetcher::release()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        outstanding--;
+    }
+    cv.notify_one();
+    wake();
+}
+
+void prefetcher::wake()
+{
+#ifdef PREFETCH_IO_URING
+    if (event_fd != -1) {
+        std::uint64_t one = 1;
+        (void)!write(event_fd, &one, sizeof one);
+    }
+#endif
+}
+
+// The blocking equivalent of what run_ring() does.
+void prefetcher::load(request &r)
+{
+    auto &file = r.file;
+    int fd = open(file.path.c_str(), O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+    if (fd == -1) {
+        file.error = errno;
+        return;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        file.error = errno;
+    } else if (S_ISREG(st.st_mode) && st.st_size > 0 && std::size_t(st.st_size) <= max_size) {
+        file.mtime = std::int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+        if (budget != nullptr) {
+            file.reserved = memory_budget::reservation::ahead(*budget, st.st_size, true);
+        }
+        file.contents.resize(st.st_size);
+
+        std::size_t used = 0;
+        while (used < file.contents.size()) {
+            ssize_t n = pread(fd, file.contents.data() + used, file.contents.size() - used, used);
+            if (n == -1 && errno == EINTR) {
+                continue;
+            } else if (n == -1) {
+                file.error = errno;
+                break;
+            } else if (n == 0) {
+                break;
+            }
+
+            used += n;
+        }
+
+        file.contents.resize(used);
+        file.loaded = file.error == 0;
+    }
+
+    close(fd);
+}
+
+void prefetcher::run_blocking()
+{
+    for (;;) {
+        std::shared_ptr<request> r;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [this] { return stopping || (!waiting.empty() && outstanding < window); });
+            r = take();
+            if (r == nullptr) {
+                return;
+            }
+        }
+
+        load(*r);
+        finish(std::move(r));
+    }
+}
+
+#ifdef PREFETCH_IO_URING
+namespace {
+enum : std::uint64_t {
+    op_wake,
+    op_open,
+    op_statx,
+    op_read,
+    op_mask = 3,
+};
+}
+
+// Each file is opened, then statted through the descriptor the open gave
+// back (so that what's read is sized from the file actually opened, not
+// whatever is at the path by then), and then read in one go (or more, if
+// the reads come up short), all from this one thread. The
+// eventfd poll wakes it up when there's a new file, room in the window or
+// room in the budget.
+void prefetcher::run_ring()
+{
+    std::unordered_map<request *, std::shared_ptr<request>> active;
+    std::vector<request *> deferred;
+    auto &ring = *uring;
+
+    auto arm_wake = [&] {
+        auto &sqe = ring.next(IORING_OP_POLL_ADD, op_wake);
+        sqe.fd = event_fd;
+        sqe.poll32_events = POLLIN;
+    };
+
+    auto submit_read = [&](request &r) {
+        auto &sqe = ring.next(IORING_OP_READ, reinterpret_cast<std::uint64_t>(&r) | op_read);
+        sqe.fd = r.fd;
+        sqe.addr = reinterpret_cast<std::uint64_t>(r.file.contents.data() + r.done_bytes);
+        sqe.len = std::min<std::size_t>(r.file.contents.size() - r.done_bytes, 1u << 30);
+        sqe.off = r.done_bytes;
+    };
+
+    auto complete = [&](request &r) {
+        if (r.fd != -1) {
+            close(r.fd);
+        }
+
+        auto node = active.extract(&r);
+        finish(std::move(node.mapped()));
+    };
+
+    // Waiting for room here would stop the reads already holding
+    // reservations from ever finishing, so a file which doesn't fit yet is
+    // put aside until some is given back.
+    auto start_read = [&](request &r) {
+        if (budget != nullptr) {
+            r.file.reserved = memory_budget::reservation::ahead(*budget, r.stx.stx_size, false);
+            if (r.file.reserved == nullptr) {
+                return false;
+            }
+        }
+
+        r.file.contents.resize(r.stx.stx_size);
+        submit_read(r);
+        return true;
+    };
+
+    auto submit_statx = [&](request &r) {
+        auto &sqe = ring.next(IORING_OP_STATX, reinterpret_cast<std::uint64_t>(&r) | op_statx);
+        sqe.fd = r.fd;
+        sqe.addr = reinterpret_cast<std::uint64_t>("");
+        sqe.statx_flags = AT_EMPTY_PATH;
+        sqe.len = STATX_TYPE | STATX_SIZE | STATX_MTIME;
+        sqe.off = reinterpret_cast<std::uint64_t>(&r.stx);
+    };
+
+    // Called once the statx is back.
+    auto statted = [&](request &r) {
+        auto &file = r.file;
+
+        file.mtime = std::int64_t(r.stx.stx_mtime.tv_sec) * 1000000000 + r.stx.stx_mtime.tv_nsec;
+        if (!S_ISREG(r.stx.stx_mode) || r.stx.stx_size == 0 || r.stx.stx_size > max_size) {
+            complete(r);
+            return;
+        }
+
+        if (!start_read(r)) {
+            deferred.push_back(&r);
+        }
+    };
+
+    arm_wake();
+
+    for (;;) {
+        std::erase_if(deferred, [&](request *r) { return start_read(*r); });
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            while (auto r = take()) {
+                auto &sqe = ring.next(IORING_OP_OPENAT, reinterpret_cast<std::uint64_t>(r.get()) | op_open);
+                sqe.fd = AT_FDCWD;
+                sqe.addr = reinterpret_cast<std::uint64_t>(r->file.path.c_str());
+                sqe.open_flags = O_RDONLY | O_CLOEXEC | O_NONBLOCK;
+
+                active.emplace(r.get(), std::move(r));
+            }
+
+            if (stopping && waiting.empty() && active.empty()) {
+                return;
+            }
+        }
+
+        ring.enter();
+
+        ring.reap([&](std::uint64_t user_data, std::int32_t res) {
+            auto op = user_data & op_mask;
+
+            if (op == op_wake) {
+                std::uint64_t count;
+                (void)!read(event_fd, &count, sizeof count);
+                arm_wake();
+                return;
+            }
+
+            auto &r = *reinterpret_cast<request *>(user_data & ~op_mask);
+            auto &file = r.file;
+
+            if (op == op_open || op == op_statx) {
+                if (res < 0) {
+                    file.error = -res;
+                    complete(r);
+                } else if (op == op_open) {
+                    r.fd = res;
+                    submit_statx(r);
+                } else {
+                    statted(r);
+                }
+            } else if (res == -EINTR || res == -EAGAIN) {
+                submit_read(r);
+            } else if (res < 0) {
+                file.error = -res;
+                complete(r);
+            } else {
+                r.done_bytes += res;
+                if (res > 0 && r.done_bytes < file.contents.size()) {
+                    submit_read(r);
+                } else {
+                    file.contents.resize(r.done_bytes);
+                    file.loaded = true;
+                    complete(r);
+                }
+            }
+        });
+    }
+}
+#else
+void prefetcher::run_ring()
+{
+}
+#endif
@@ -0,0 +1,116 @@
+/*-
+ * Copyright (c) 2023 Chris Spiegel
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef OPENMPT_CHARSET_PREFETCH_HPP
+#define OPENMPT_CHARSET_PREFETCH_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "budget.hpp"
+#include "workpool.hpp"
+
+// A file read ahead of time by a prefetcher.
+struct prefetched_file {
+    std::string path;
+
+    // An errno value, if the file couldn't be opened or read.
+    int error = 0;
+
+    // Only non-empty regular files no larger than the prefetcher's limit
+    // are read; anything else is left to be opened the usual way.
+    bool loaded = false;
+    std::vector<char> contents;
+    std::int64_t mtime = 0;
+
+    // With a budget, what was reserved for the contents before they were
+    // read; it's given back when the file is freed.
+    std::unique_ptr<memory_budget::reservation> reserved;
+};
+
+// Opens and reads files before they are needed, so that on slow storage
+// the device always has a window of requests to work on while the pool
+// is busy checking files which have already arrived. On Linux this is
+// done with io_uring from a single thread; elsewhere, or if io_uring
+// isn't available, a few threads do plain blocking reads instead.
+//
+// The window limits how many files can be in flight or waiting to be
+// checked, and so, along with the size limit, how much memory read-ahead
+// can take. If a budget is given, each file's size is reserved from it
+// before the file is read, and a file waits without being read until
+// there's room.
+class prefetcher {
+public:
+    // Called on the pool when the file is ready.
+    using handler = std::function<void(prefetched_file &file)>;
+
+    prefetcher(work_pool &pool, std::size_t window, std::size_t max_size, memory_budget *budget = nullptr);
+    ~prefetcher();
+
+    prefetcher(const prefetcher &) = delete;
+    prefetcher &operator=(const prefetcher &) = delete;
+
+    // Never blocks; the pool counts the file as pending until its
+    // handler has run.
+    void submit(std::string path, handler done);
+
+private:
+    struct request;
+    class ring;
+
+    std::shared_ptr<request> take();
+    void load(request &r);
+    void finish(std::shared_ptr<request> r);
+    void release();
+    void wake();
+    void run_blocking();
+    void run_ring();
+
+    work_pool &pool;
+    std::size_t window;
+    std::size_t max_size;
+    memory_budget *budget;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::shared_ptr<request>> waiting;
+    std::size_t outstanding = 0;
+    bool stopping = false;
+
+    std::unique_ptr<ring> uring;
+    int event_fd = -1;
+    std::vector<std::thread> threads;
+};
+
+#endif
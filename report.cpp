@@ -0,0 +1,358 @@
+/*-
+ * Copyright (c) 2023 Chris Spiegel
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include "report.hpp"
+#include "utf8.hpp"
+#include "width.hpp"
+
+namespace {
+void put8(output_buffer &out, std::uint8_t v)
+{
+    out << char(v);
+}
+
+void put32(output_buffer &out, std::uint32_t v)
+{
+    for (int i = 0; i < 4; i++) {
+        out << char(v >> (i * 8));
+    }
+}
+
+void put64(output_buffer &out, std::uint64_t v)
+{
+    for (int i = 0; i < 8; i++) {
+        out << char(v >> (i * 8));
+    }
+}
+
+void put_string(output_buffer &out, std::string_view s)
+{
+    put32(out, s.size());
+    out << s;
+}
+
+bool valid_utf8(std::string_view s)
+{
+    auto p = reinterpret_cast<const unsigned char *>(s.data());
+    auto end = p + s.size();
+
+    while (p != end) {
+        auto before = p;
+        char encoded[4];
+
+        // Decoding replaces anything ill-formed, so only valid text
+        // comes back out exactly as it went in.
+        auto n = utf8_encode(utf8_decode(p, end), encoded);
+        if (std::size_t(p - before) != n || std::memcmp(before, encoded, n) != 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// A JSON string. If s isn't valid UTF-8, every byte from 0x80 up is
+// escaped as the codepoint of the same value.
+void put_json(output_buffer &out, std::string_view s)
+{
+    static constexpr char hex[] = "0123456789abcdef";
+
+    bool bytes = !valid_utf8(s);
+
+    out << '"';
+    for (char c : s) {
+        auto u = static_cast<unsigned char>(c);
+
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        } else if (c == '\n') {
+            out << "\\n";
+        } else if (c == '\t') {
+            out << "\\t";
+        } else if (u < 0x20 || u == 0x7f || (bytes && u >= 0x80)) {
+            out << "\\u00" << hex[u >> 4] << hex[u & 15];
+        } else {
+            out << c;
+        }
+    }
+    out << '"';
+}
+
+void print_line(output_buffer &out, std::string_view line, std::string_view new_line, std::size_t columns)
+{
+    if (columns == report_writer::unmeasured) {
+        columns = display_width(line);
+    }
+
+    out << line;
+    if (columns < 80) {
+        out.pad(80 - columns);
+    }
+
+    out << " | " << new_line << '\n';
+}
+}
+
+void report_writer::begin()
+{
+    if (begun) {
+        return;
+    }
+
+    begun = true;
+
+    switch (format) {
+    case report_format::text:
+        out << "Difference in " << filename << ":\n\n";
+        break;
+    case report_format::jsonl:
+        out << "{\"file\":";
+        put_json(out, filename);
+        break;
+    case report_format::binary:
+        // The length and status are filled in by end().
+        put32(out, 0);
+        put8(out, 1);
+        put8(out, 0);
+        put_string(out, filename);
+        break;
+    }
+}
+
+void report_writer::end(status s)
+{
+    static constexpr std::string_view names[] = {"no_message", "no_difference", "difference", "not_module", "error"};
+
+    switch (format) {
+    case report_format::text:
+        if (begun) {
+            out << '\n';
+        }
+        break;
+    case report_format::jsonl:
+        begin();
+        if (in_lines) {
+            out << ']';
+        }
+        out << ",\"status\":\"" << names[std::size_t(s)] << "\"}\n";
+        break;
+    case report_format::binary: {
+        begin();
+        char header[6];
+        std::uint32_t length = out.size() - start - 4;
+        for (int i = 0; i < 4; i++) {
+            header[i] = char(length >> (i * 8));
+        }
+        header[4] = 1;
+        header[5] = char(s);
+        out.overwrite(start, std::string_view(header, sizeof header));
+        break;
+    }
+    }
+
+    in_lines = false;
+}
+
+void report_writer::line(const text_field &where, std::string_view original, std::string_view converted, std::size_t columns)
+{
+    begin();
+
+    switch (format) {
+    case report_format::text:
+        if (!where.label.empty()) {
+            auto mark = out.size();
+            out << where.label;
+            if (where.index != text_field::no_index) {
+                out << ' ' << where.index;
+            }
+            out << ':';
+            out.pad(std::max<std::size_t>(16 - (out.size() - mark), 1));
+        }
+        print_line(out, original, converted, columns);
+        break;
+    case report_format::jsonl:
+        out << (in_lines ? ",{" : ",\"lines\":[{");
+        in_lines = true;
+        if (where.label.empty()) {
+            out << "\"line\":" << where.index;
+        } else {
+            out << "\"field\":";
+            put_json(out, where.label);
+            if (where.index != text_field::no_index) {
+                out << ",\"index\":" << where.index;
+            }
+        }
+        out << ",\"original\":";
+        put_json(out, original);
+        out << ",\"converted\":";
+        put_json(out, converted);
+        out << '}';
+        break;
+    case report_format::binary:
+        put8(out, 1);
+        put_string(out, where.label);
+        put32(out, where.index);
+        put_string(out, original);
+        put_string(out, converted);
+        break;
+    }
+}
+
+void report_writer::guess(const charset_guess &guess)
+{
+    unsigned confidence = guess.confidence * 100 + 0.5;
+
+    switch (format) {
+    case report_format::text:
+        out << "Likely charset of " << filename << ": " << guess.best->name
+            << " (confidence " << confidence << "%, next " << guess.runner_up->name << ")\n";
+        break;
+    case report_format::jsonl:
+        begin();
+        if (in_lines) {
+            out << ']';
+            in_lines = false;
+        }
+        out << ",\"guess\":{\"charset\":\"" << guess.best->name << "\",\"confidence\":" << confidence
+            << ",\"next\":\"" << guess.runner_up->name << "\"}";
+        break;
+    case report_format::binary:
+        begin();
+        put8(out, 2);
+        put_string(out, guess.best->name);
+        put_string(out, guess.runner_up->name);
+        put8(out, confidence);
+        break;
+    }
+}
+
+void report_writer::finish(check_outcome outcome)
+{
+    end(static_cast<status>(outcome));
+}
+
+void report_writer::not_module()
+{
+    end(status::not_module);
+}
+
+void report_writer::fail(std::string_view error)
+{
+    out.truncate(start);
+    begun = false;
+    in_lines = false;
+
+    if (format == report_format::text) {
+        return;
+    }
+
+    begin();
+    if (format == report_format::jsonl) {
+        out << ",\"error\":";
+        put_json(out, error);
+    } else {
+        put8(out, 3);
+        put_string(out, error);
+    }
+    end(status::error);
+}
+
+void write_stats(output_buffer &out, report_format format, const stats_snapshot &stats, std::uint64_t elapsed_ns)
+{
+    auto histograms = [&](auto &&f) {
+        for (std::size_t i = 0; i < stage_count; i++) {
+            f(stage_names[i], stats.stages[i]);
+        }
+        f("file", stats.files);
+    };
+
+    switch (format) {
+    case report_format::text:
+        break;
+    case report_format::jsonl: {
+        out << "{\"stats\":{\"elapsed\":" << elapsed_ns << ",\"bytes\":" << stats.bytes << ",\"stages\":{";
+        bool first = true;
+        histograms([&](const char *name, const latency_histogram &h) {
+            out << (first ? "\"" : ",\"") << name << "\":{\"count\":" << h.count << ",\"total\":" << h.total
+                << ",\"max\":" << h.max << ",\"buckets\":[";
+            first = false;
+            bool first_bucket = true;
+            for (std::size_t i = 0; i < h.bucket_count; i++) {
+                if (h.buckets[i] != 0) {
+                    out << (first_bucket ? "[" : ",[") << i << ',' << h.buckets[i] << ']';
+                    first_bucket = false;
+                }
+            }
+            out << "]}";
+        });
+        out << "},\"slowest\":[";
+        for (std::size_t i = 0; i < stats.slowest.size(); i++) {
+            out << (i == 0 ? "[" : ",[") << stats.slowest[i].first << ',';
+            put_json(out, stats.slowest[i].second);
+            out << ']';
+        }
+        out << "]}}\n";
+        break;
+    }
+    case report_format::binary: {
+        auto start = out.size();
+        put32(out, 0);
+        put8(out, 2);
+        put64(out, elapsed_ns);
+        put64(out, stats.bytes);
+        put32(out, stage_count + 1);
+        histograms([&](const char *name, const latency_histogram &h) {
+            put_string(out, name);
+            put64(out, h.count);
+            put64(out, h.total);
+            put64(out, h.max);
+            put32(out, std::count_if(h.buckets.begin(), h.buckets.end(), [](std::uint64_t n) { return n != 0; }));
+            for (std::size_t i = 0; i < h.bucket_count; i++) {
+                if (h.buckets[i] != 0) {
+                    put32(out, i);
+                    put64(out, h.buckets[i]);
+                }
+            }
+        });
+        put32(out, stats.slowest.size());
+        for (const auto &[ns, filename] : stats.slowest) {
+            put64(out, ns);
+            put_string(out, filename);
+        }
+
+        char length[4];
+        std::uint32_t n = out.size() - start - 4;
+        for (int i = 0; i < 4; i++) {
+            length[i] = char(n >> (i * 8));
+        }
+        out.overwrite(start, std::string_view(length, sizeof length));
+        break;
+    }
+    }
+}
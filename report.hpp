@@ -0,0 +1,146 @@
+/*-
+ * Copyright (c) 2023 Chris Spiegel
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef OPENMPT_CHARSET_REPORT_HPP
+#define OPENMPT_CHARSET_REPORT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include "cache.hpp"
+#include "fields.hpp"
+#include "guess.hpp"
+#include "output.hpp"
+#include "stats.hpp"
+
+enum class report_format : std::uint8_t {
+    // "Difference in ...", then each line beside its conversion, padded to
+    // 80 columns. Nothing at all for files without differences.
+    text,
+
+    // One JSON object per line for every file.
+    jsonl,
+
+    // One length-prefixed record for every file.
+    binary,
+};
+
+// Builds the report for one file in an output buffer. Nothing is written
+// until there is something to say, so a report which is never used (for
+// a file answered from the cache, say) leaves the buffer untouched.
+//
+// The machine-readable formats have a record for every file, whether or
+// not it differs, which is completed by one of finish(), not_module() or
+// fail(). Lines there have no padding.
+//
+// JSONL records look like
+//
+//   {"file":"a.it","lines":[{"line":3,"original":"...","converted":"..."}],"status":"difference"}
+//
+// with "field" and "index" rather than "line" for --all-fields, "guess"
+// ({"charset","confidence","next"}) for --guess, and "error" when status
+// is "error". Other statuses are "no_message", "no_difference" and
+// "not_module". Original text is as libopenmpt gives it, each byte as
+// the codepoint of the same value, so that encoding it as Latin-1 gives
+// back exactly what was in the file. Anything which isn't valid UTF-8,
+// such as an odd filename, has its bytes from 0x80 up escaped the same
+// way.
+//
+// Binary records (all integers little-endian, strings as u32:length
+// then the bytes) are
+//
+//   u32:body-length body
+//   body:  u8:kind u8:status string:file items...
+//   items: u8:1 string:label u32:index string:original string:converted
+//          u8:2 string:charset string:next u8:confidence
+//          u8:3 string:error
+//
+// where kind is 1 for a file, status is 0 for no message, 1 for no
+// difference, 2 for a difference, 3 for not a module and 4 for an error,
+// and label is empty (with index the line number) for message lines
+// outside of --all-fields. Items run to the end of the body.
+class report_writer {
+public:
+    report_writer(output_buffer &out, report_format format, std::string_view filename) : out(out), format(format), filename(filename), start(out.size()) {}
+
+    report_writer(const report_writer &) = delete;
+    report_writer &operator=(const report_writer &) = delete;
+
+    std::string_view name() const { return filename; }
+
+    static constexpr std::size_t unmeasured = SIZE_MAX;
+
+    // A line which changes in conversion. Message lines have an empty
+    // label, and are numbered from 1. columns is the display width of
+    // original, if the caller already knows it.
+    void line(const text_field &where, std::string_view original, std::string_view converted, std::size_t columns = unmeasured);
+
+    void guess(const charset_guess &guess);
+
+    void finish(check_outcome outcome);
+    void not_module();
+
+    // Throws away anything written so far, and records the error instead.
+    void fail(std::string_view error);
+
+private:
+    enum class status : std::uint8_t {
+        no_message,
+        no_difference,
+        difference,
+        not_module,
+        error,
+    };
+
+    void begin();
+    void end(status s);
+
+    output_buffer &out;
+    const report_format format;
+    const std::string_view filename;
+    const std::size_t start;
+    bool begun = false;
+    bool in_lines = false;
+};
+
+// For --stats in the machine-readable formats, a record after all the
+// files with everything --stats counted, so that --merge can add up the
+// stats of several runs. In JSONL, that's
+//
+//   {"stats":{"elapsed":ns,"bytes":n,"stages":{"open":...,"file":...},"slowest":[[ns,"a.it"],...]}}
+//
+// where "file" is the time taken by whole files, and each stage is
+// {"count","total","max","buckets":[[bucket,n],...]} with only the
+// buckets in use listed. Times are in nanoseconds. In binary, it's a
+// record of kind 2:
+//
+//   body:      u8:2 u64:elapsed u64:bytes u32:count histogram... u32:count slow...
+//   histogram: string:name u64:count u64:total u64:max u32:count (u32:bucket u64:n)...
+//   slow:      u64:ns string:file
+void write_stats(output_buffer &out, report_format format, const stats_snapshot &stats, std::uint64_t elapsed_ns);
+
+#endif
@@ -0,0 +1,68 @@
+/*-
+ * Copyright (c) 2023 Chris Spiegel
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef OPENMPT_CHARSET_SCRATCH_HPP
+#define OPENMPT_CHARSET_SCRATCH_HPP
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+
+// Memory for things which only live as long as the file being checked.
+// Each thread has its own arena, so allocating from it never touches
+// the global allocator's locks; and since everything in it is released
+// at once when the file is done, the block it starts with is enough for
+// all but the largest files, and is reused from one file to the next.
+//
+// Only what's allocated afresh for each file belongs here, which now
+// means natively read messages. Buffers which are simply reused from one
+// file to the next (the converted lines, the collected fields) are kept
+// thread_local instead, and results kept for deduplication outlive the
+// file.
+class scratch_arena {
+public:
+    scratch_arena() : resource(initial, sizeof initial) {}
+
+    scratch_arena(const scratch_arena &) = delete;
+    scratch_arena &operator=(const scratch_arena &) = delete;
+
+    std::pmr::memory_resource *get() { return &resource; }
+
+    // Everything allocated from the arena must be gone by now.
+    void reset() { resource.release(); }
+
+    static scratch_arena &local()
+    {
+        thread_local auto arena = std::make_unique<scratch_arena>();
+        return *arena;
+    }
+
+private:
+    alignas(std::max_align_t) std::byte initial[64 * 1024];
+    std::pmr::monotonic_buffer_resource resource;
+};
+
+#endif
@@ -0,0 +1,391 @@
+/*-
+ * Copyright (c) 2023 Chris Spiegel
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <system_error>
+#include <thread>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "server.hpp"
+
+namespace {
+constexpr std::size_t max_line_size = 64 * 1024;
+constexpr std::size_t max_data_size = 256 * 1024 * 1024;
+constexpr std::size_t max_id_size = 64;
+
+// Written to by the signal handler, to wake up the accept loop.
+int signal_pipe[2] = {-1, -1};
+
+extern "C" void on_signal(int)
+{
+    char c = 0;
+    [[maybe_unused]] auto n = write(signal_pipe[1], &c, 1);
+}
+
+class connection {
+public:
+    explicit connection(int fd) : fd(fd) {}
+    ~connection() { close(fd); }
+
+    connection(const connection &) = delete;
+    connection &operator=(const connection &) = delete;
+
+    int descriptor() const { return fd; }
+
+    // Sends text all in one go, so that replies finished by different
+    // workers can't interleave. Once a send fails (because the client has
+    // gone away) the rest are dropped.
+    void send(std::string_view text)
+    {
+        std::lock_guard lock(mutex);
+
+        while (!broken && !text.empty()) {
+            ssize_t n = ::send(fd, text.data(), text.size(), MSG_NOSIGNAL);
+            if (n == -1 && errno == EINTR) {
+                continue;
+            } else if (n <= 0) {
+                broken = true;
+            } else {
+                text.remove_prefix(n);
+            }
+        }
+    }
+
+    // Makes the reading thread see the end of the requests.
+    void stop() { shutdown(fd, SHUT_RD); }
+
+private:
+    const int fd;
+    std::mutex mutex;
+    bool broken = false;
+};
+
+// Buffered reading of request lines and the data which follows them.
+class request_reader {
+public:
+    explicit request_reader(int fd) : fd(fd) {}
+
+    // Reads up to and not including the next newline. False at the end
+    // of the connection, or if a line is unreasonably long.
+    bool line(std::string &line)
+    {
+        for (std::size_t scanned = 0;;) {
+            auto newline = std::find(buffer.begin() + start + scanned, buffer.begin() + end, '\n');
+            if (newline != buffer.begin() + end) {
+                line.assign(buffer.begin() + start, newline);
+                start = newline - buffer.begin() + 1;
+                return true;
+            }
+
+            scanned = end - start;
+            if (scanned >= max_line_size || !fill()) {
+                return false;
+            }
+        }
+    }
+
+    bool bytes(std::vector<char> &data, std::size_t n)
+    {
+        data.resize(n);
+
+        std::size_t have = std::min(n, end - start);
+        std::copy(buffer.begin() + start, buffer.begin() + start + have, data.begin());
+        start += have;
+
+        // Anything beyond what's already buffered goes straight into place.
+        while (have < n) {
+            ssize_t got = read(fd, data.data() + have, n - have);
+            if (got == -1 && errno == EINTR) {
+                continue;
+            } else if (got <= 0) {
+                return false;
+            }
+            have += got;
+        }
+
+        return true;
+    }
+
+private:
+    bool fill()
+    {
+        if (start > 0) {
+            std::copy(buffer.begin() + start, buffer.begin() + end, buffer.begin());
+            end -= start;
+            start = 0;
+        }
+
+        if (end == buffer.size()) {
+            buffer.resize(std::max<std::size_t>(buffer.size() * 2, 4096));
+        }
+
+        for (;;) {
+            ssize_t n = read(fd, buffer.data() + end, buffer.size() - end);
+            if (n == -1 && errno == EINTR) {
+                continue;
+            } else if (n <= 0) {
+                return false;
+            }
+            end += n;
+            return true;
+        }
+    }
+
+    const int fd;
+    std::vector<char> buffer;
+    std::size_t start = 0;
+    std::size_t end = 0;
+};
+
+bool valid_id(std::string_view id)
+{
+    return !id.empty() && id.size() <= max_id_size && std::all_of(id.begin(), id.end(), [](unsigned char c) {
+        return std::isalnum(c) || c == '.' || c == '_' || c == '-';
+    });
+}
+
+// Takes the next space-separated word off the front of s.
+std::string_view next_word(std::string_view &s)
+{
+    auto space = s.find(' ');
+    auto word = s.substr(0, space);
+
+    s.remove_prefix(space == std::string_view::npos ? s.size() : space + 1);
+    return word;
+}
+
+// Fills in request from a request line, reading any data which follows
+// it. Returns an error message if that can't be done.
+const char *parse_request(std::string_view line, request_reader &in, serve_request &request, memory_budget *budget)
+{
+    auto verb = next_word(line);
+    auto id = next_word(line);
+
+    if (!valid_id(id)) {
+        return "bad request id";
+    }
+
+    request.id = id;
+
+    if (verb == "path") {
+        if (line.empty()) {
+            return "missing path";
+        }
+        request.name = line;
+        return nullptr;
+    }
+
+    if (verb == "data") {
+        auto length = next_word(line);
+        std::size_t n;
+        auto [end, ec] = std::from_chars(length.data(), length.data() + length.size(), n);
+        if (ec != std::errc() || end != length.data() + length.size() || n > max_data_size) {
+            return "bad data length";
+        }
+
+        request.name = line;
+        if (budget != nullptr) {
+            request.reserved = memory_budget::reservation::ahead(*budget, n, true);
+        }
+        if (!in.bytes(request.data.emplace(), n)) {
+            return "incomplete data";
+        }
+        return nullptr;
+    }
+
+    return "unknown request";
+}
+
+// Adds the id to each of the records, and then the end of the reply.
+void tag_records(std::string_view id, std::string_view records, std::string &reply)
+{
+    std::size_t count = 0;
+
+    while (!records.empty()) {
+        auto newline = records.find('\n');
+        auto record = records.substr(0, newline);
+        records.remove_prefix(newline == std::string_view::npos ? records.size() : newline + 1);
+
+        // The id is spliced into each record's object. report_writer
+        // only writes objects, but anything else is dropped rather than
+        // turned into broken JSON.
+        if (record.empty() || record.front() != '{') {
+            continue;
+        }
+
+        reply += "{\"id\":\"";
+        reply += id;
+        reply += "\",";
+        reply += record.substr(1);
+        reply += '\n';
+        count++;
+    }
+
+    reply += "{\"id\":\"";
+    reply += id;
+    reply += "\",\"done\":";
+    reply += std::to_string(count);
+    reply += "}\n";
+}
+
+void read_requests(const std::shared_ptr<connection> &conn, work_pool &pool, const serve_handler &handler, memory_budget *budget)
+{
+    request_reader in(conn->descriptor());
+    std::string line;
+
+    while (in.line(line)) {
+        serve_request request;
+
+        if (auto error = parse_request(line, in, request, budget)) {
+            conn->send(std::string("{\"error\":\"") + error + "\"}\n");
+            return;
+        }
+
+        // The connection is closed once the last reply to it is sent.
+        // Shared, since a task has to be copyable and the request holds
+        // its reservation.
+        pool.submit([conn, &handler, request = std::make_shared<serve_request>(std::move(request))] {
+            thread_local std::string records;
+            thread_local std::string reply;
+
+            records.clear();
+            handler(*request, records);
+
+            reply.clear();
+            tag_records(request->id, records, reply);
+            conn->send(reply);
+        });
+    }
+}
+
+// The server only keeps a weak reference to a connection, so that it is
+// closed as soon as its thread and replies are all done with it.
+struct client {
+    std::weak_ptr<connection> conn;
+    std::shared_ptr<std::atomic<bool>> done;
+    std::thread thread;
+};
+}
+
+void serve(const std::string &socket_path, work_pool &pool, serve_handler handler, memory_budget *budget)
+{
+    sockaddr_un addr = {};
+    if (socket_path.size() >= sizeof addr.sun_path) {
+        throw std::system_error(ENAMETOOLONG, std::generic_category());
+    }
+
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, socket_path.c_str(), socket_path.size() + 1);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener == -1) {
+        throw std::system_error(errno, std::generic_category());
+    }
+
+    unlink(socket_path.c_str());
+    if (bind(listener, reinterpret_cast<sockaddr *>(&addr), sizeof addr) == -1 || listen(listener, SOMAXCONN) == -1 ||
+        pipe2(signal_pipe, O_CLOEXEC | O_NONBLOCK) == -1) {
+        int error = errno;
+        close(listener);
+        throw std::system_error(error, std::generic_category());
+    }
+
+    struct sigaction action = {}, old_int, old_term;
+    action.sa_handler = on_signal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, &old_int);
+    sigaction(SIGTERM, &action, &old_term);
+
+    std::vector<client> clients;
+
+    for (;;) {
+        pollfd fds[] = {{listener, POLLIN, 0}, {signal_pipe[0], POLLIN, 0}};
+
+        if (poll(fds, 2, -1) == -1) {
+            continue;
+        } else if (fds[1].revents != 0) {
+            break;
+        } else if (fds[0].revents == 0) {
+            continue;
+        }
+
+        int fd = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd == -1) {
+            continue;
+        }
+
+        // Finished clients are only cleaned up when a new one arrives,
+        // which keeps the list from growing without needing a thread of
+        // its own to do it.
+        std::erase_if(clients, [](client &c) {
+            if (c.done->load()) {
+                c.thread.join();
+                return true;
+            }
+            return false;
+        });
+
+        auto conn = std::make_shared<connection>(fd);
+        auto done = std::make_shared<std::atomic<bool>>(false);
+        std::thread thread([conn, done, &pool, &handler, budget] {
+            read_requests(conn, pool, handler, budget);
+            *done = true;
+        });
+
+        clients.push_back({conn, std::move(done), std::move(thread)});
+    }
+
+    // Stop taking requests, then let everything already taken finish.
+    for (auto &c : clients) {
+        if (auto conn = c.conn.lock()) {
+            conn->stop();
+        }
+        c.thread.join();
+    }
+    clients.clear();
+    pool.wait();
+
+    sigaction(SIGINT, &old_int, nullptr);
+    sigaction(SIGTERM, &old_term, nullptr);
+    close(signal_pipe[0]);
+    close(signal_pipe[1]);
+    close(listener);
+    unlink(socket_path.c_str());
+}
@@ -0,0 +1,85 @@
+/*-
+ * Copyright (c) 2023 Chris Spiegel
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef OPENMPT_CHARSET_SERVER_HPP
+#define OPENMPT_CHARSET_SERVER_HPP
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "budget.hpp"
+#include "workpool.hpp"
+
+// One request from a client of serve().
+struct serve_request {
+    std::string id;
+
+    // The path of the file to check or, for data sent along with the
+    // request, the name the client gave it.
+    std::string name;
+    std::optional<std::vector<char>> data;
+
+    // With a budget, what was reserved for data before it was read.
+    std::unique_ptr<memory_budget::reservation> reserved;
+};
+
+// Checks one request, appending its JSONL records (one per line) to
+// reply.
+using serve_handler = std::function<void(serve_request &request, std::string &reply)>;
+
+// Listens on a Unix socket at socket_path, and checks what clients ask for
+// on the pool until the process gets SIGINT or SIGTERM. Each connection
+// has a thread of its own reading requests, but the checking is done by
+// the pool, whose workers (and their buffers and arenas) last for as long
+// as the server does.
+//
+// Requests are lines, and any number can be sent without waiting for the
+// replies:
+//
+//   path ID PATH                  check the file at PATH
+//   data ID LENGTH NAME           check the LENGTH bytes which follow the
+//                                 line, reporting them as NAME
+//
+// An ID is up to 64 letters, digits, '.', '_' and '-'. Each request is
+// answered by its records, in the same form as --format=jsonl but with
+// "id" added, followed by {"id":ID,"done":N}, where N is the number of
+// records. Replies to different requests come back in the order they
+// finish, not the order they were sent. After a request which can't be
+// parsed, the server sends {"error":MESSAGE} and closes the connection.
+//
+// If a budget is given, the length of each data request is reserved from
+// it before the data is read, as read-ahead; the connection's thread waits
+// for room, and reads nothing more from that client in the meantime.
+//
+// An existing socket at socket_path is replaced. Errors setting up the
+// socket are reported by throwing std::system_error.
+void serve(const std::string &socket_path, work_pool &pool, serve_handler handler, memory_budget *budget = nullptr);
+
+#endif
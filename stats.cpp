@@ -0,0 +1,253 @@
+/*-
+ * Copyright (c) 2023 Chris Spiegel
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+
+#include "stats.hpp"
+
+bool stats_enabled = false;
+
+// How many of the slowest files are remembered.
+static constexpr std::size_t slowest_count = 10;
+
+std::size_t latency_histogram::bucket(std::uint64_t ns)
+{
+    if (ns < 16) {
+        return ns;
+    }
+
+    std::size_t exponent = std::bit_width(ns) - 1;
+    std::size_t sub = (ns >> (exponent - 3)) & 7;
+
+    return std::min(16 + (exponent - 4) * 8 + sub, bucket_count - 1);
+}
+
+std::uint64_t latency_histogram::bucket_limit(std::size_t bucket)
+{
+    if (bucket < 16) {
+        return bucket;
+    }
+
+    std::size_t exponent = (bucket - 16) / 8 + 4;
+    std::uint64_t sub = (bucket - 16) % 8;
+
+    return ((8 + sub + 1) << (exponent - 3)) - 1;
+}
+
+void latency_histogram::merge(const latency_histogram &other)
+{
+    for (std::size_t i = 0; i < bucket_count; i++) {
+        buckets[i] += other.buckets[i];
+    }
+
+    count += other.count;
+    total += other.total;
+    max = std::max(max, other.max);
+}
+
+std::uint64_t latency_histogram::percentile(double fraction) const
+{
+    auto wanted = std::uint64_t(fraction * count);
+    std::uint64_t seen = 0;
+
+    for (std::size_t i = 0; i < bucket_count; i++) {
+        seen += buckets[i];
+        if (seen > wanted || seen == count) {
+            return std::min(bucket_limit(i), max);
+        }
+    }
+
+    return max;
+}
+
+namespace {
+// Only the owning thread ever writes to these, so relaxed atomics are
+// enough to make reading them from elsewhere well-defined.
+struct atomic_histogram {
+    std::array<std::atomic<std::uint64_t>, latency_histogram::bucket_count> buckets{};
+    std::atomic<std::uint64_t> count{0};
+    std::atomic<std::uint64_t> total{0};
+    std::atomic<std::uint64_t> max{0};
+
+    void record(std::uint64_t ns)
+    {
+        auto add = [](std::atomic<std::uint64_t> &a, std::uint64_t n) {
+            a.store(a.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        };
+
+        add(buckets[latency_histogram::bucket(ns)], 1);
+        add(count, 1);
+        add(total, ns);
+        if (ns > max.load(std::memory_order_relaxed)) {
+            max.store(ns, std::memory_order_relaxed);
+        }
+    }
+
+    void copy_to(latency_histogram &h) const
+    {
+        latency_histogram mine;
+
+        for (std::size_t i = 0; i < h.bucket_count; i++) {
+            mine.buckets[i] = buckets[i].load(std::memory_order_relaxed);
+        }
+
+        mine.count = count.load(std::memory_order_relaxed);
+        mine.total = total.load(std::memory_order_relaxed);
+        mine.max = max.load(std::memory_order_relaxed);
+        h.merge(mine);
+    }
+};
+
+struct thread_stats {
+    std::array<atomic_histogram, stage_count> stages;
+    atomic_histogram files;
+    std::atomic<std::uint64_t> bytes{0};
+    std::vector<std::pair<std::uint64_t, std::string>> slowest;
+};
+
+std::mutex registry_mutex;
+std::vector<std::unique_ptr<thread_stats>> registry;
+
+thread_stats &local_stats()
+{
+    thread_local thread_stats *mine = [] {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        registry.push_back(std::make_unique<thread_stats>());
+        return registry.back().get();
+    }();
+
+    return *mine;
+}
+
+bool slower(const std::pair<std::uint64_t, std::string> &a, const std::pair<std::uint64_t, std::string> &b)
+{
+    return a.first > b.first;
+}
+}
+
+void stats_record(stage s, std::uint64_t ns)
+{
+    local_stats().stages[std::size_t(s)].record(ns);
+}
+
+void stats_file_done(std::string_view filename, std::uint64_t bytes, std::uint64_t ns)
+{
+    auto &stats = local_stats();
+
+    stats.files.record(ns);
+    stats.bytes.store(stats.bytes.load(std::memory_order_relaxed) + bytes, std::memory_order_relaxed);
+
+    // A heap with the fastest of the slow files on top.
+    auto &slowest = stats.slowest;
+    if (slowest.size() < slowest_count) {
+        slowest.emplace_back(ns, filename);
+        std::push_heap(slowest.begin(), slowest.end(), slower);
+    } else if (ns > slowest.front().first) {
+        std::pop_heap(slowest.begin(), slowest.end(), slower);
+        slowest.back() = {ns, std::string(filename)};
+        std::push_heap(slowest.begin(), slowest.end(), slower);
+    }
+}
+
+stats_snapshot stats_collect()
+{
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    stats_snapshot snapshot;
+
+    for (const auto &stats : registry) {
+        for (std::size_t i = 0; i < stage_count; i++) {
+            stats->stages[i].copy_to(snapshot.stages[i]);
+        }
+
+        stats->files.copy_to(snapshot.files);
+        snapshot.bytes += stats->bytes.load(std::memory_order_relaxed);
+        snapshot.slowest.insert(snapshot.slowest.end(), stats->slowest.begin(), stats->slowest.end());
+    }
+
+    std::sort(snapshot.slowest.begin(), snapshot.slowest.end(), slower);
+    if (snapshot.slowest.size() > slowest_count) {
+        snapshot.slowest.resize(slowest_count);
+    }
+
+    return snapshot;
+}
+
+void stats_snapshot::merge(const stats_snapshot &other)
+{
+    for (std::size_t i = 0; i < stage_count; i++) {
+        stages[i].merge(other.stages[i]);
+    }
+
+    files.merge(other.files);
+    bytes += other.bytes;
+
+    slowest.insert(slowest.end(), other.slowest.begin(), other.slowest.end());
+    std::stable_sort(slowest.begin(), slowest.end(), slower);
+    if (slowest.size() > slowest_count) {
+        slowest.resize(slowest_count);
+    }
+}
+
+void stats_print(const stats_snapshot &stats, double elapsed_seconds, std::ostream &os)
+{
+    auto us = [](std::uint64_t ns) { return ns / 1000.0; };
+    auto per_second = [elapsed_seconds](double n) { return elapsed_seconds > 0 ? n / elapsed_seconds : 0; };
+
+    os << std::fixed << std::setprecision(1);
+    os << stats.files.count << " file(s) in " << std::setprecision(3) << elapsed_seconds << "s"
+       << std::setprecision(1) << " (" << per_second(stats.files.count) << " files/s), "
+       << stats.bytes / 1e6 << " MB input (" << per_second(stats.bytes / 1e6) << " MB/s)\n\n";
+
+    os << std::left << std::setw(10) << "stage" << std::right
+       << std::setw(10) << "count" << std::setw(12) << "total ms"
+       << std::setw(11) << "p50 us" << std::setw(11) << "p99 us" << std::setw(11) << "max us" << '\n';
+
+    auto row = [&](const char *name, const latency_histogram &h) {
+        os << std::left << std::setw(10) << name << std::right
+           << std::setw(10) << h.count << std::setw(12) << h.total / 1e6
+           << std::setw(11) << us(h.percentile(0.5)) << std::setw(11) << us(h.percentile(0.99))
+           << std::setw(11) << us(h.max) << '\n';
+    };
+
+    for (std::size_t i = 0; i < stage_count; i++) {
+        row(stage_names[i], stats.stages[i]);
+    }
+    row("file", stats.files);
+
+    if (!stats.slowest.empty()) {
+        os << "\nslowest files:\n" << std::setprecision(3);
+        for (const auto &[ns, filename] : stats.slowest) {
+            os << std::setw(10) << ns / 1e6 << " ms  " << filename << '\n';
+        }
+    }
+
+    os << std::defaultfloat << std::flush;
+}
@@ -0,0 +1,161 @@
+/*-
+ * Copyright (c) 2023 Chris Spiegel
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef OPENMPT_CHARSET_STATS_HPP
+#define OPENMPT_CHARSET_STATS_HPP
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Optional timing of each stage of checking a file, for --stats. Every
+// thread records into its own block of counters, so recording never
+// contends; the blocks are only added up at the end. When disabled, a
+// timer costs one test of a global flag.
+
+enum class stage {
+    open,
+    probe,
+    native,
+    hash,
+    parse,
+    metadata,
+    scan,
+    convert,
+    format,
+    write,
+};
+
+inline constexpr std::size_t stage_count = std::size_t(stage::write) + 1;
+
+inline constexpr const char *stage_names[stage_count] = {
+    "open", "probe", "native", "hash", "parse", "metadata", "scan", "convert", "format", "write",
+};
+
+extern bool stats_enabled;
+
+// Latencies in nanoseconds, in log-linear buckets: exact below 16ns, then
+// eight buckets per power of two, so that any percentile read back from
+// the histogram is within 12.5% of the truth.
+struct latency_histogram {
+    static constexpr std::size_t bucket_count = 16 + 8 * 60;
+
+    static std::size_t bucket(std::uint64_t ns);
+    static std::uint64_t bucket_limit(std::size_t bucket);
+
+    std::array<std::uint64_t, bucket_count> buckets{};
+    std::uint64_t count = 0;
+    std::uint64_t total = 0;
+    std::uint64_t max = 0;
+
+    void merge(const latency_histogram &other);
+
+    // An upper bound for the given fraction (0 to 1) of samples.
+    std::uint64_t percentile(double fraction) const;
+};
+
+// Everything recorded by all threads, added up.
+struct stats_snapshot {
+    std::array<latency_histogram, stage_count> stages;
+    latency_histogram files;
+    std::uint64_t bytes = 0;
+    std::vector<std::pair<std::uint64_t, std::string>> slowest;
+
+    // Add in the stats of another run, such as another shard's.
+    void merge(const stats_snapshot &other);
+};
+
+void stats_record(stage s, std::uint64_t ns);
+void stats_file_done(std::string_view filename, std::uint64_t bytes, std::uint64_t ns);
+
+// Only safe to call when no other thread is still recording.
+stats_snapshot stats_collect();
+
+void stats_print(const stats_snapshot &stats, double elapsed_seconds, std::ostream &os);
+
+inline std::uint64_t stats_now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Records the time between construction and destruction against a stage.
+class stage_timer {
+public:
+    explicit stage_timer(stage s) : s(s), start(stats_enabled ? stats_now() : 0) {}
+
+    ~stage_timer()
+    {
+        if (stats_enabled) {
+            stats_record(s, stats_now() - start);
+        }
+    }
+
+    stage_timer(const stage_timer &) = delete;
+    stage_timer &operator=(const stage_timer &) = delete;
+
+private:
+    stage s;
+    std::uint64_t start;
+};
+
+// Runs f, recording how long it took. The result is returned directly,
+// so even types which can't be copied or moved can be timed.
+template <typename F>
+decltype(auto) timed(stage s, F &&f)
+{
+    stage_timer timer(s);
+    return f();
+}
+
+// Records the total time taken by one file, along with its size.
+class file_timer {
+public:
+    explicit file_timer(std::string_view filename) : filename(filename), start(stats_enabled ? stats_now() : 0) {}
+
+    ~file_timer()
+    {
+        if (stats_enabled) {
+            stats_file_done(filename, bytes, stats_now() - start);
+        }
+    }
+
+    file_timer(const file_timer &) = delete;
+    file_timer &operator=(const file_timer &) = delete;
+
+    std::uint64_t bytes = 0;
+
+private:
+    std::string_view filename;
+    std::uint64_t start;
+};
+
+#endif
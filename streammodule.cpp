@@ -0,0 +1,170 @@
+/*-
+ * Copyright (c) 2023 Chris Spiegel
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <unistd.h>
+
+#include "streammodule.hpp"
+
+// Copies out of the window where possible. A read which misses it either
+// goes straight to the destination, if it's at least as big as the
+// window anyway, or refills the window from the current position.
+std::size_t stream_module::window_reader::read(void *dst, std::size_t bytes)
+{
+    auto out = static_cast<char *>(dst);
+    std::size_t total = 0;
+
+    bytes = std::min<std::uint64_t>(bytes, size - std::min(position, size));
+
+    while (total < bytes) {
+        if (position >= window_start && position < window_start + window_length) {
+            std::size_t offset = position - window_start;
+            std::size_t n = std::min(bytes - total, window_length - offset);
+
+            std::memcpy(out + total, window.data() + offset, n);
+            total += n;
+            position += n;
+            continue;
+        }
+
+        char *target = bytes - total >= window_size ? out + total : window.data();
+        std::size_t want = target == window.data() ? window_size : bytes - total;
+
+        ssize_t n = pread(fd, target, want, position);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        } else if (n <= 0) {
+            break;
+        }
+
+        if (target == window.data()) {
+            window_start = position;
+            window_length = n;
+        } else {
+            total += n;
+            position += n;
+        }
+    }
+
+    return total;
+}
+
+int stream_module::window_reader::seek(std::int64_t offset, int whence)
+{
+    std::int64_t base = whence == OPENMPT_STREAM_SEEK_SET ? 0 : whence == OPENMPT_STREAM_SEEK_CUR ? std::int64_t(position) : std::int64_t(size);
+
+    if (base + offset < 0) {
+        return -1;
+    }
+
+    position = base + offset;
+    return 0;
+}
+
+stream_module::stream_module(int fd, std::uint64_t size, std::ostream &log, const std::map<std::string, std::string> &ctls) : reader{fd, size}
+{
+    openmpt_stream_callbacks callbacks = {
+        [](void *stream, void *dst, std::size_t bytes) { return static_cast<window_reader *>(stream)->read(dst, bytes); },
+        [](void *stream, std::int64_t offset, int whence) { return static_cast<window_reader *>(stream)->seek(offset, whence); },
+        [](void *stream) { return std::int64_t(static_cast<window_reader *>(stream)->position); },
+    };
+
+    std::vector<openmpt_module_initial_ctl> initial_ctls;
+    for (const auto &[ctl, value] : ctls) {
+        initial_ctls.push_back({ctl.c_str(), value.c_str()});
+    }
+    initial_ctls.push_back({nullptr, nullptr});
+
+    auto logger = [](const char *message, void *user) {
+        *static_cast<std::ostream *>(user) << message << '\n';
+    };
+
+    int error = 0;
+    const char *error_message = nullptr;
+
+    mod = openmpt_module_create2(callbacks, &reader, logger, &log, openmpt_error_func_store, nullptr, &error, &error_message, initial_ctls.data());
+    if (mod == nullptr) {
+        std::string what = error_message != nullptr ? error_message : "error loading module";
+        openmpt_free_string(error_message);
+        throw std::runtime_error(what);
+    }
+
+    openmpt_free_string(error_message);
+}
+
+stream_module::~stream_module()
+{
+    openmpt_module_destroy(mod);
+}
+
+// libopenmpt's strings have to be handed back to it to free.
+static std::string take_string(const char *s)
+{
+    std::string result = s != nullptr ? s : "";
+    openmpt_free_string(s);
+    return result;
+}
+
+template <typename Count, typename Name>
+static std::vector<std::string> get_names(openmpt_module *mod, Count count, Name name)
+{
+    std::vector<std::string> names;
+
+    for (std::int32_t i = 0, n = count(mod); i < n; i++) {
+        names.push_back(take_string(name(mod, i)));
+    }
+
+    return names;
+}
+
+std::string stream_module::get_metadata(const std::string &key) const
+{
+    return take_string(openmpt_module_get_metadata(mod, key.c_str()));
+}
+
+std::vector<std::string> stream_module::get_sample_names() const
+{
+    return get_names(mod, openmpt_module_get_num_samples, openmpt_module_get_sample_name);
+}
+
+std::vector<std::string> stream_module::get_instrument_names() const
+{
+    return get_names(mod, openmpt_module_get_num_instruments, openmpt_module_get_instrument_name);
+}
+
+std::vector<std::string> stream_module::get_pattern_names() const
+{
+    return get_names(mod, openmpt_module_get_num_patterns, openmpt_module_get_pattern_name);
+}
+
+std::vector<std::string> stream_module::get_channel_names() const
+{
+    return get_names(mod, openmpt_module_get_num_channels, openmpt_module_get_channel_name);
+}
@@ -0,0 +1,81 @@
+/*-
+ * Copyright (c) 2023 Chris Spiegel
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef OPENMPT_CHARSET_STREAMMODULE_HPP
+#define OPENMPT_CHARSET_STREAMMODULE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <libopenmpt/libopenmpt.h>
+
+// A module loaded through libopenmpt's stream callbacks from a file
+// descriptor, instead of from one block of memory. Reads go through a
+// small fixed window, so however large the file is, only the parts
+// libopenmpt actually asks for are ever in memory (or mapped), and then
+// only a window's worth at a time.
+//
+// This has the same accessors as openmpt::module for the things this
+// program uses, so code can be written for either. Failure to load is
+// reported by throwing std::runtime_error.
+class stream_module {
+public:
+    static constexpr std::size_t window_size = 64 * 1024;
+
+    stream_module(int fd, std::uint64_t size, std::ostream &log, const std::map<std::string, std::string> &ctls);
+    ~stream_module();
+
+    stream_module(const stream_module &) = delete;
+    stream_module &operator=(const stream_module &) = delete;
+
+    std::string get_metadata(const std::string &key) const;
+    std::vector<std::string> get_sample_names() const;
+    std::vector<std::string> get_instrument_names() const;
+    std::vector<std::string> get_pattern_names() const;
+    std::vector<std::string> get_channel_names() const;
+
+private:
+    struct window_reader {
+        int fd;
+        std::uint64_t size;
+        std::uint64_t position = 0;
+        std::uint64_t window_start = 0;
+        std::size_t window_length = 0;
+        std::vector<char> window = std::vector<char>(window_size);
+
+        std::size_t read(void *dst, std::size_t bytes);
+        int seek(std::int64_t offset, int whence);
+    };
+
+    window_reader reader;
+    openmpt_module *mod = nullptr;
+};
+
+#endif
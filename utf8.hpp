@@ -0,0 +1,181 @@
+/*-
+ * Copyright (c) 2023 Chris Spiegel
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef OPENMPT_CHARSET_UTF8_HPP
+#define OPENMPT_CHARSET_UTF8_HPP
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// UTF-8 decoding and encoding which never throws. Ill-formed input is
+// decoded to U+FFFD, one replacement character per maximal subpart of
+// the bad sequence (Unicode 3.9, "U+FFFD Substitution of Maximal
+// Subparts"), which is the same policy browsers use. Codepoints which
+// can't be encoded (surrogates and anything past U+10FFFF) are encoded
+// as U+FFFD as well.
+
+inline constexpr std::uint32_t utf8_replacement = 0xFFFD;
+
+// Length of the run of ASCII bytes at the start of s, looking at 32 or
+// 16 bytes at a time where the CPU allows.
+inline std::size_t ascii_length(const char *s, std::size_t n)
+{
+    std::size_t i = 0;
+
+#if defined(__AVX2__)
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + i));
+        unsigned mask = _mm256_movemask_epi8(v);
+        if (mask != 0) {
+            return i + std::countr_zero(mask);
+        }
+    }
+#endif
+
+#if defined(__SSE2__)
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + i));
+        unsigned mask = _mm_movemask_epi8(v);
+        if (mask != 0) {
+            return i + std::countr_zero(mask);
+        }
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    for (; i + 16 <= n; i += 16) {
+        uint8x16_t v = vld1q_u8(reinterpret_cast<const std::uint8_t *>(s + i));
+        if (vmaxvq_u8(v) >= 0x80) {
+            // NEON has no movemask; narrowing the comparison instead
+            // leaves four bits of the mask for each byte.
+            uint8x16_t high = vcgeq_u8(v, vdupq_n_u8(0x80));
+            uint8x8_t nibbles = vshrn_n_u16(vreinterpretq_u16_u8(high), 4);
+            std::uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(nibbles), 0);
+            return i + std::countr_zero(mask) / 4;
+        }
+    }
+#endif
+
+    for (; i + 8 <= n; i += 8) {
+        std::uint64_t word;
+        std::memcpy(&word, s + i, sizeof word);
+        if ((word & 0x8080808080808080) != 0) {
+            break;
+        }
+    }
+
+    while (i < n && static_cast<unsigned char>(s[i]) < 0x80) {
+        i++;
+    }
+
+    return i;
+}
+
+// Decode one codepoint from the non-empty range [p, end), advancing p
+// past it. p always moves forward by at least one byte.
+inline std::uint32_t utf8_decode(const unsigned char *&p, const unsigned char *end)
+{
+    unsigned char c = *p++;
+    unsigned char lo = 0x80, hi = 0xBF;
+    std::uint32_t cp;
+    int need;
+
+    if (c < 0x80) {
+        return c;
+    } else if (c >= 0xC2 && c <= 0xDF) {
+        need = 1;
+        cp = c & 0x1F;
+    } else if (c >= 0xE0 && c <= 0xEF) {
+        need = 2;
+        cp = c & 0x0F;
+        if (c == 0xE0) {
+            lo = 0xA0;      // Overlong.
+        } else if (c == 0xED) {
+            hi = 0x9F;      // Surrogates.
+        }
+    } else if (c >= 0xF0 && c <= 0xF4) {
+        need = 3;
+        cp = c & 0x07;
+        if (c == 0xF0) {
+            lo = 0x90;      // Overlong.
+        } else if (c == 0xF4) {
+            hi = 0x8F;      // Past U+10FFFF.
+        }
+    } else {
+        return utf8_replacement;
+    }
+
+    while (need-- > 0) {
+        if (p == end || *p < lo || *p > hi) {
+            return utf8_replacement;
+        }
+
+        cp = (cp << 6) | (*p++ & 0x3F);
+        lo = 0x80;
+        hi = 0xBF;
+    }
+
+    return cp;
+}
+
+// Encode c into out, which must have room for four bytes, returning the
+// number of bytes written.
+constexpr std::size_t utf8_encode(std::uint32_t c, char *out)
+{
+    if (c < 0x80) {
+        out[0] = char(c);
+        return 1;
+    } else if (c < 0x800) {
+        out[0] = char(0xC0 | (c >> 6));
+        out[1] = char(0x80 | (c & 0x3F));
+        return 2;
+    } else if (c >= 0xD800 && c <= 0xDFFF) {
+        return utf8_encode(utf8_replacement, out);
+    } else if (c < 0x10000) {
+        out[0] = char(0xE0 | (c >> 12));
+        out[1] = char(0x80 | ((c >> 6) & 0x3F));
+        out[2] = char(0x80 | (c & 0x3F));
+        return 3;
+    } else if (c < 0x110000) {
+        out[0] = char(0xF0 | (c >> 18));
+        out[1] = char(0x80 | ((c >> 12) & 0x3F));
+        out[2] = char(0x80 | ((c >> 6) & 0x3F));
+        out[3] = char(0x80 | (c & 0x3F));
+        return 4;
+    } else {
+        return utf8_encode(utf8_replacement, out);
+    }
+}
+
+#endif
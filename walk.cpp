@@ -0,0 +1,159 @@
+/*-
+ * Copyright (c) 2023 Chris Spiegel
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <cctype>
+
+#include "walk.hpp"
+
+namespace fs = std::filesystem;
+
+bool walk_filter::matches(const fs::directory_entry &entry, std::error_code &ec) const
+{
+    if (!extensions.empty()) {
+        auto ext = entry.path().extension().string();
+        if (ext.empty()) {
+            return false;
+        }
+
+        std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
+        if (std::find(extensions.begin(), extensions.end(), std::string_view(ext).substr(1)) == extensions.end()) {
+            return false;
+        }
+    }
+
+    // Only stat the file if a filter actually needs it.
+    if (min_size || max_size) {
+        auto size = entry.file_size(ec);
+        if (ec) {
+            return false;
+        }
+
+        if ((min_size && size < *min_size) || (max_size && size > *max_size)) {
+            return false;
+        }
+    }
+
+    if (newer_than) {
+        auto mtime = entry.last_write_time(ec);
+        if (ec) {
+            return false;
+        }
+
+        if (mtime <= *newer_than) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void tree_walker::submit(const std::string &path)
+{
+    auto slot = output.reserve();
+
+    pool.submit([this, path, slot] { scan(path, slot); });
+}
+
+void tree_walker::scan(const std::string &path, ordered_output::ticket slot)
+{
+    std::error_code ec;
+
+    if (fs::is_directory(path, ec)) {
+        walk(path, slot);
+    } else {
+        // Anything else, including paths which don't exist, is left to
+        // the file checker to make sense of (or complain about).
+        visit(path, slot, true);
+    }
+}
+
+void tree_walker::walk(const fs::path &dir, ordered_output::ticket slot)
+{
+    thread_local output_buffer none;
+    thread_local output_buffer err;
+    std::vector<fs::directory_entry> files;
+    std::vector<fs::directory_entry> subdirs;
+    std::error_code ec;
+
+    // Nothing more is wanted, so don't even read the directory.
+    if (pool.cancelled()) {
+        output.complete(slot, none, err);
+        return;
+    }
+
+    auto complain = [](output_buffer &err, const fs::path &path, const std::error_code &ec) {
+        err << "can't read " << path.string() << ": " << ec.message() << '\n';
+    };
+
+    for (fs::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+        const auto &entry = *it;
+        std::error_code entry_ec;
+
+        // This uses the file type from the directory listing where the
+        // system provides one, so plain files aren't stat()ed here.
+        if (entry.is_symlink(entry_ec)) {
+            if (entry.is_regular_file(entry_ec) && filter.matches(entry, entry_ec)) {
+                files.push_back(entry);
+            }
+        } else if (entry.is_directory(entry_ec)) {
+            subdirs.push_back(entry);
+        } else if (entry.is_regular_file(entry_ec) && filter.matches(entry, entry_ec)) {
+            files.push_back(entry);
+        }
+
+        if (entry_ec) {
+            complain(err, entry.path(), entry_ec);
+        }
+    }
+
+    if (ec) {
+        complain(err, dir, ec);
+    }
+
+    // Files first, then subdirectories, each in name order.
+    auto by_name = [](const fs::directory_entry &a, const fs::directory_entry &b) { return a.path().filename() < b.path().filename(); };
+    std::sort(files.begin(), files.end(), by_name);
+    std::sort(subdirs.begin(), subdirs.end(), by_name);
+
+    auto slots = output.reserve_after(slot, files.size() + subdirs.size());
+
+    // The directory's own slot is completed before anything under it is
+    // queued: when running single-threaded, submitted tasks run
+    // immediately, and their reports should be written, not held back
+    // behind this slot.
+    output.complete(slot, none, err);
+    err.clear();
+
+    std::size_t i = 0;
+    for (const auto &entry : files) {
+        pool.submit([this, path = entry.path().string(), slot = slots[i++]] { visit(path, slot, false); });
+    }
+
+    for (const auto &entry : subdirs) {
+        pool.submit([this, path = entry.path(), slot = slots[i++]] { walk(path, slot); });
+    }
+}
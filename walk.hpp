@@ -0,0 +1,92 @@
+/*-
+ * Copyright (c) 2023 Chris Spiegel
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef OPENMPT_CHARSET_WALK_HPP
+#define OPENMPT_CHARSET_WALK_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "output.hpp"
+#include "workpool.hpp"
+
+// Restrictions on which files found while walking a directory are
+// checked. Files named directly by the user are always checked.
+struct walk_filter {
+    // Lowercase extensions, without the dot; empty means any.
+    std::vector<std::string> extensions;
+    std::optional<std::uintmax_t> min_size;
+    std::optional<std::uintmax_t> max_size;
+    std::optional<std::filesystem::file_time_type> newer_than;
+
+    bool matches(const std::filesystem::directory_entry &entry, std::error_code &ec) const;
+};
+
+// Expands paths named by the user into the files to check. Directories
+// are walked recursively on the worker pool, one task per directory, so
+// several directories are read at once and files start being checked as
+// soon as they are found rather than once the whole tree is known.
+// Entries are visited in name order, and each directory's files take its
+// place in the output, so the output is the same regardless of how the
+// work gets scheduled.
+//
+// Only regular files are visited from directories, since a FIFO or a
+// device could block a reader forever or never come to an end. Symbolic
+// links to files are followed; symbolic links to directories are not,
+// unless named directly by the user.
+//
+// Once the pool has been cancelled, directories are no longer read, and
+// their slots are left empty.
+class tree_walker {
+public:
+    // named is true for a path the user named, rather than one found in
+    // a directory.
+    using visit_file = std::function<void(const std::string &path, ordered_output::ticket slot, bool named)>;
+
+    tree_walker(work_pool &pool, ordered_output &output, walk_filter filter, visit_file visit)
+        : pool(pool), output(output), filter(std::move(filter)), visit(std::move(visit))
+    {
+    }
+
+    // Queue up a path named by the user.
+    void submit(const std::string &path);
+
+private:
+    void scan(const std::string &path, ordered_output::ticket slot);
+    void walk(const std::filesystem::path &dir, ordered_output::ticket slot);
+
+    work_pool &pool;
+    ordered_output &output;
+    walk_filter filter;
+    visit_file visit;
+};
+
+#endif
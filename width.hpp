@@ -0,0 +1,107 @@
+/*-
+ * Copyright (c) 2023 Chris Spiegel
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef OPENMPT_CHARSET_WIDTH_HPP
+#define OPENMPT_CHARSET_WIDTH_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include "utf8.hpp"
+#include "width_table.hpp"
+
+// The number of terminal columns a codepoint takes up: 2 for East Asian
+// wide and fullwidth characters, 0 for combining marks, controls and
+// other zero-width characters, and 1 for everything else.
+constexpr unsigned unicode_width(std::uint32_t c)
+{
+    if (c >= 0x110000) {
+        return 1;
+    }
+
+    const auto &block = width_blocks[width_index[c >> 8]];
+    return (block[(c & 0xFF) >> 2] >> ((c & 3) * 2)) & 3;
+}
+
+// The number of columns the UTF-8 string s takes up. Runs of printable
+// ASCII are counted 32 or 16 bytes at a time where the CPU allows; the
+// rest is decoded as described in utf8.hpp, so a sequence cut short at
+// the end of s is never read past.
+inline std::size_t display_width(std::string_view s)
+{
+    auto p = reinterpret_cast<const unsigned char *>(s.data());
+    auto end = p + s.size();
+    std::size_t width = 0;
+
+    while (p != end) {
+        // Printable ASCII is 0x20 to 0x7E. Bytes 0x80 and above are
+        // negative as signed chars, so "greater than 0x1F" leaves them
+        // out along with the controls.
+#if defined(__AVX2__)
+        while (end - p >= 32) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+            __m256i printable = _mm256_andnot_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(0x7F)), _mm256_cmpgt_epi8(v, _mm256_set1_epi8(0x1F)));
+            if (_mm256_movemask_epi8(printable) != -1) {
+                break;
+            }
+            p += 32;
+            width += 32;
+        }
+#endif
+
+#if defined(__SSE2__)
+        while (end - p >= 16) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+            __m128i printable = _mm_andnot_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(0x7F)), _mm_cmpgt_epi8(v, _mm_set1_epi8(0x1F)));
+            if (_mm_movemask_epi8(printable) != 0xFFFF) {
+                break;
+            }
+            p += 16;
+            width += 16;
+        }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+        while (end - p >= 16) {
+            uint8x16_t v = vld1q_u8(p);
+            uint8x16_t printable = vandq_u8(vcgeq_u8(v, vdupq_n_u8(0x20)), vcltq_u8(v, vdupq_n_u8(0x7F)));
+            if (vminvq_u8(printable) == 0) {
+                break;
+            }
+            p += 16;
+            width += 16;
+        }
+#endif
+
+        // Whatever stopped the fast path, and then anything else up to
+        // the next chance to use it.
+        std::uint32_t c = *p < 0x80 ? *p++ : utf8_decode(p, end);
+        width += unicode_width(c);
+    }
+
+    return width;
+}
+
+#endif
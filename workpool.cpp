@@ -0,0 +1,184 @@
+/*-
+ * Copyright (c) 2023 Chris Spiegel
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "workpool.hpp"
+
+// The pool and index of the worker running on the current thread, if any.
+static thread_local work_pool *current_pool = nullptr;
+static thread_local std::size_t current_worker = 0;
+
+work_pool::work_pool(unsigned nthreads, std::size_t queue_limit) : queue_limit(queue_limit)
+{
+    for (unsigned i = 0; i < nthreads; i++) {
+        queues.push_back(std::make_unique<worker_queue>());
+    }
+
+    for (unsigned i = 0; i < nthreads; i++) {
+        threads.emplace_back(&work_pool::run, this, i);
+    }
+}
+
+work_pool::~work_pool()
+{
+    wait();
+
+    {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        stopping = true;
+    }
+    work_cv.notify_all();
+
+    for (auto &thread : threads) {
+        thread.join();
+    }
+}
+
+void work_pool::submit(task t)
+{
+    if (threads.empty()) {
+        t();
+        return;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(state_mutex);
+        if (current_pool != this && queue_limit != 0) {
+            space_cv.wait(lock, [this] { return pending < queue_limit; });
+        }
+        pending++;
+    }
+
+    push(std::move(t));
+}
+
+void work_pool::hold()
+{
+    std::lock_guard<std::mutex> lock(state_mutex);
+    pending++;
+}
+
+void work_pool::submit_held(task t)
+{
+    if (threads.empty()) {
+        t();
+        finished();
+        return;
+    }
+
+    push(std::move(t));
+}
+
+void work_pool::push(task t)
+{
+    if (current_pool == this) {
+        auto &queue = *queues[current_worker];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_front(std::move(t));
+    } else {
+        auto &queue = *queues[next_queue++ % queues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(std::move(t));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        queued++;
+    }
+    work_cv.notify_one();
+}
+
+void work_pool::finished()
+{
+    std::lock_guard<std::mutex> lock(state_mutex);
+    if (--pending == 0) {
+        done_cv.notify_all();
+    }
+    if (queue_limit != 0) {
+        space_cv.notify_one();
+    }
+}
+
+void work_pool::wait()
+{
+    std::unique_lock<std::mutex> lock(state_mutex);
+    done_cv.wait(lock, [this] { return pending == 0; });
+}
+
+bool work_pool::try_pop(std::size_t self, task &t)
+{
+    {
+        auto &queue = *queues[self];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.tasks.empty()) {
+            t = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+            return true;
+        }
+    }
+
+    for (std::size_t i = 1; i < queues.size(); i++) {
+        auto &queue = *queues[(self + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.tasks.empty()) {
+            t = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void work_pool::run(std::size_t self)
+{
+    current_pool = this;
+    current_worker = self;
+
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(state_mutex);
+            work_cv.wait(lock, [this] { return queued > 0 || stopping; });
+            if (queued == 0) {
+                return;
+            }
+
+            // Claim one task. It is guaranteed to be sitting in one of
+            // the deques, though possibly not found on the first sweep
+            // if other workers are popping at the same time.
+            queued--;
+        }
+
+        task t;
+        while (!try_pop(self, t)) {
+            std::this_thread::yield();
+        }
+
+        t();
+        t = nullptr;
+
+        finished();
+    }
+}
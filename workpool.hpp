@@ -0,0 +1,112 @@
+/*-
+ * Copyright (c) 2023 Chris Spiegel
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef OPENMPT_CHARSET_WORKPOOL_HPP
+#define OPENMPT_CHARSET_WORKPOOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads, each with its own task deque. Workers
+// take work from the front of their own deque and, when that runs dry,
+// steal from the back of the others'. Tasks submitted from inside a
+// worker go to that worker's deque, so work spawned by a task tends to
+// stay on the same thread.
+//
+// A pool created with zero threads runs every task synchronously inside
+// submit(), which keeps single-threaded runs free of any locking or
+// thread hand-off.
+//
+// If a queue limit is given, submit() called from outside the pool blocks
+// while that many tasks are waiting or running, so a producer reading a
+// long list of files can't get arbitrarily far ahead of the workers.
+// Tasks submitted by other tasks are never held back, since that could
+// deadlock the pool.
+class work_pool {
+public:
+    using task = std::function<void()>;
+
+    explicit work_pool(unsigned nthreads, std::size_t queue_limit = 0);
+    ~work_pool();
+
+    work_pool(const work_pool &) = delete;
+    work_pool &operator=(const work_pool &) = delete;
+
+    void submit(task t);
+
+    // For work which starts outside the pool, such as a read in progress
+    // elsewhere, and only becomes a task later: hold() counts the task as
+    // pending straight away, so that wait() won't return without it, and
+    // submit_held() then queues it. submit_held() never blocks, since the
+    // task was already counted against the queue limit.
+    void hold();
+    void submit_held(task t);
+
+    // Block until every submitted task, including tasks submitted by
+    // other tasks, has finished.
+    void wait();
+
+    // Ask for the rest of the work to be abandoned. This is cooperative:
+    // every task submitted still runs (tasks can have bookkeeping to do,
+    // such as handing back a prefetcher's window), but tasks which check
+    // cancelled() can return without doing their real work.
+    void cancel() { is_cancelled.store(true, std::memory_order_relaxed); }
+    bool cancelled() const { return is_cancelled.load(std::memory_order_relaxed); }
+
+private:
+    struct worker_queue {
+        std::mutex mutex;
+        std::deque<task> tasks;
+    };
+
+    void push(task t);
+    void finished();
+    void run(std::size_t self);
+    bool try_pop(std::size_t self, task &t);
+
+    std::vector<std::unique_ptr<worker_queue>> queues;
+    std::vector<std::thread> threads;
+    std::atomic<std::size_t> next_queue{0};
+    std::atomic<bool> is_cancelled{false};
+
+    std::mutex state_mutex;
+    std::condition_variable work_cv;
+    std::condition_variable done_cv;
+    std::condition_variable space_cv;
+    std::size_t queue_limit;
+    std::size_t queued = 0;
+    std::size_t pending = 0;
+    bool stopping = false;
+};
+
+#endif